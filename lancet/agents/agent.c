@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <math.h>
+#include <signal.h>
 
 #include <lancet/agent.h>
 #include <lancet/manager.h>
@@ -35,6 +36,9 @@
 #include <lancet/stats.h>
 #include <lancet/app_proto.h>
 #include <lancet/timestamping.h>
+#include <lancet/dump.h>
+#include <lancet/topology.h>
+#include <lancet/sort.h>
 
 static struct agent_config *cfg;
 static __thread struct request to_send;
@@ -51,6 +55,24 @@ int get_thread_count(void)
 	return cfg->thread_count;
 }
 
+/*
+ * Every connection is used, the first conn_count % thread_count threads
+ * get one more
+ */
+int get_thread_conn_count(int thread)
+{
+	return cfg->conn_count / cfg->thread_count +
+		(thread < cfg->conn_count % cfg->thread_count);
+}
+
+int get_thread_conn_base(int thread)
+{
+	int rem = cfg->conn_count % cfg->thread_count;
+
+	return thread * (cfg->conn_count / cfg->thread_count) +
+		(thread < rem ? thread : rem);
+}
+
 int get_target_count(void)
 {
 	return cfg->target_count;
@@ -66,11 +88,66 @@ struct rand_gen *get_ia_gen(void)
 	return cfg->idist;
 }
 
+struct application_protocol *get_app_proto(void)
+{
+	return cfg->app_proto;
+}
+
 long get_ia(void)
 {
 	return lround(generate(cfg->idist) * 1000);
 }
 
+/*
+ * Send time of the request after the one at next_tx, following the
+ * load schedule if there is one
+ */
+long get_next_tx(long next_tx)
+{
+	if (cfg->load_sched)
+		return load_sched_next(cfg->load_sched, next_tx, get_ia());
+	return next_tx + get_ia();
+}
+
+struct load_sched *get_load_sched(void)
+{
+	return cfg->load_sched;
+}
+
+int get_tenant_count(void)
+{
+	return cfg->tenant_count;
+}
+
+struct tenant *get_tenants(void)
+{
+	return cfg->tenants;
+}
+
+int get_target_tenant(int target)
+{
+	return find_tenant(cfg->tenants, cfg->tenant_count, target);
+}
+
+/*
+ * The mean rate offered over [from, to], time_ns() values, for a
+ * START_LOAD of load
+ */
+double get_offered_rate(uint32_t load, long from, long to)
+{
+	if (cfg->tenant_count)
+		return tenants_offered_rate(cfg->tenants, cfg->tenant_count, load,
+				from, to);
+	return cfg->load_sched ? load_sched_rate(cfg->load_sched, from, to) :
+		load;
+}
+
+/* As get_next_tx() for the arrivals of a tenant */
+long get_tenant_next_tx(int tenant, long next_tx)
+{
+	return tenant_next_tx(&cfg->tenants[tenant], next_tx);
+}
+
 struct request *prepare_request(void)
 {
 	create_request(cfg->app_proto, &to_send);
@@ -92,6 +169,10 @@ void set_load(uint32_t load)
 	set_reference_load(load);
 	per_thread_load = load / (double)cfg->thread_count;
 	set_avg(cfg->idist, 1e6 / per_thread_load);
+	if (cfg->load_sched)
+		load_sched_start(cfg->load_sched, load);
+	tenants_set_load(cfg->tenants, cfg->tenant_count, load,
+			cfg->thread_count);
 }
 
 enum agent_type get_agent_type(void)
@@ -104,6 +185,36 @@ int get_agent_tid(void)
 	return thread_idx;
 }
 
+enum conn_policy get_conn_policy(void)
+{
+	return cfg->policy;
+}
+
+double *get_target_weights(void)
+{
+	return cfg->target_weights;
+}
+
+char *get_if_name(void)
+{
+	return cfg->if_name;
+}
+
+int get_perf_counters(void)
+{
+	return cfg->perf_counters;
+}
+
+int get_max_pending(void)
+{
+	return cfg->max_pending;
+}
+
+int get_rx_buf_size(void)
+{
+	return cfg->rx_buf_size;
+}
+
 static void *agent_main(void *arg)
 {
 	cpu_set_t cpuset;
@@ -112,18 +223,28 @@ static void *agent_main(void *arg)
 
 	thread = pthread_self();
 	thread_idx = (int)(long)arg;
-	init_per_thread_stats();
-
-	srand(time(NULL) + thread_idx * 12345);
 
+	/*
+	 * Pin before allocating anything, so that the first touch puts the
+	 * stats and connection memory on the thread's node
+	 */
 	CPU_ZERO(&cpuset);
-	CPU_SET(thread_idx, &cpuset);
+	CPU_SET(placement_cpu(thread_idx), &cpuset);
 
 	s = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
 	if (s != 0) {
 		lancet_perror("pthread_setaffinity_np");
 		return NULL;
 	}
+
+	init_per_thread_stats();
+	if (dump_thread_init()) {
+		lancet_fprintf(stderr, "failed to init the sample dump\n");
+		return NULL;
+	}
+
+	srand(time(NULL) + thread_idx * 12345);
+
 	cfg->tp->tp_main[cfg->atype]();
 
 	return NULL;
@@ -131,21 +252,42 @@ static void *agent_main(void *arg)
 
 int main(int argc, char **argv)
 {
-	int i;
+	int i, sort_cpus[MAX_SORT_WORKERS], sort_cpu_count;
 	pthread_t *tids;
 
 	cfg = parse_arguments(argc, argv);
 	if (!cfg)
 		exit(-1);
 
-	if (cfg->atype == SYMMETRIC_NIC_TIMESTAMP_AGENT)
-		enable_nic_timestamping(IF_NAME);
+	if (placement_init(cfg->placement, cfg->manager_cpus, cfg->if_name,
+				cfg->thread_count))
+		exit(-1);
+	/* The manager sorts the samples on the CPUs the agent leaves idle */
+	sort_cpu_count = placement_idle_cpus(cfg->thread_count, sort_cpus,
+			MAX_SORT_WORKERS - 1);
+	pin_sort_workers(sort_cpus, sort_cpu_count);
+
+	/* Broken connections are handled where the write fails */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (cfg->atype == SYMMETRIC_NIC_TIMESTAMP_AGENT) {
+		if (!cfg->if_name) {
+			lancet_fprintf(stderr, "NIC timestamping needs an interface\n");
+			exit(-1);
+		}
+		enable_nic_timestamping(cfg->if_name);
+	}
 
 	if (manager_init(cfg->thread_count)) {
 		lancet_fprintf(stderr, "failed to init the manager\n");
 		exit(-1);
 	}
 
+	if (cfg->dump_path && dump_init(cfg->dump_path)) {
+		lancet_fprintf(stderr, "failed to init the sample dump\n");
+		exit(-1);
+	}
+
 	tids = malloc(cfg->thread_count * sizeof(pthread_t));
 	if (!tids) {
 		lancet_fprintf(stderr, "Failed to allocate tids\n");
@@ -0,0 +1,59 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#include <sys/mman.h>
+
+#include <lancet/arena.h>
+#include <lancet/error.h>
+
+#define ARENA_ALIGN 64
+
+int arena_init(struct arena *arena, size_t size)
+{
+	arena->base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (arena->base == MAP_FAILED) {
+		lancet_perror("Failed to map the arena");
+		return -1;
+	}
+	arena->size = size;
+	arena->used = 0;
+	return 0;
+}
+
+/*
+ * Cache line aligned, so that the slabs of two connections never share
+ * a line. There is no free, the arena lives as long as the thread.
+ */
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	void *ret;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (arena->used + size > arena->size)
+		return NULL;
+	ret = arena->base + arena->used;
+	arena->used += size;
+	return ret;
+}
@@ -26,8 +26,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <string.h>
+#include <sys/un.h>
+#include <linux/vm_sockets.h>
 
 #include <lancet/agent.h>
 #include <lancet/error.h>
@@ -35,12 +39,115 @@
 #include <lancet/rand_gen.h>
 #include <lancet/app_proto.h>
 
+static int parse_unix_target(char *path, int socktype,
+		struct host_tuple *target)
+{
+	struct sockaddr_un *sun = (struct sockaddr_un *)&target->addr;
+
+	if (strlen(path) >= sizeof(sun->sun_path)) {
+		lancet_fprintf(stderr, "Unix socket path too long: %s\n", path);
+		return -1;
+	}
+	sun->sun_family = AF_UNIX;
+	strcpy(sun->sun_path, path);
+	target->addr_len = sizeof(struct sockaddr_un);
+	target->socktype = socktype;
+	return 0;
+}
+
+/*
+ * Resolve once at startup, the connect paths only see the sockaddr.
+ * IPv6 literals go in brackets: [::1]:8000
+ */
+static int resolve(char *host, char *port, int family,
+		struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+	struct addrinfo hints, *res;
+	size_t len = strlen(host);
+	int ret;
+
+	if (host[0] == '[' && host[len - 1] == ']') {
+		host[len - 1] = '\0';
+		host++;
+	}
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = family;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret) {
+		lancet_fprintf(stderr, "Failed to resolve %s: %s\n", host,
+				gai_strerror(ret));
+		return -1;
+	}
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+static int parse_target(char *spec, struct host_tuple *target)
+{
+	struct sockaddr_vm *svm = (struct sockaddr_vm *)&target->addr;
+	char *port, *src;
+
+	memset(target, 0, sizeof(struct host_tuple));
+	if (!strncmp(spec, "unix:", 5))
+		return parse_unix_target(spec + 5, SOCK_STREAM, target);
+	if (!strncmp(spec, "unixpacket:", 11))
+		return parse_unix_target(spec + 11, SOCK_SEQPACKET, target);
+
+	/* host:port@source binds the connections to a source address */
+	src = strchr(spec, '@');
+	if (src)
+		*src++ = '\0';
+	port = strrchr(spec, ':');
+	if (!port) {
+		lancet_fprintf(stderr, "Target %s has no port\n", spec);
+		return -1;
+	}
+	*port++ = '\0';
+	target->socktype = SOCK_STREAM;
+	if (!strncmp(spec, "vsock:", 6)) {
+		svm->svm_family = AF_VSOCK;
+		svm->svm_cid = strtoul(spec + 6, NULL, 10);
+		svm->svm_port = strtoul(port, NULL, 10);
+		target->addr_len = sizeof(struct sockaddr_vm);
+		return 0;
+	}
+	if (resolve(spec, port, AF_UNSPEC, &target->addr, &target->addr_len))
+		return -1;
+	if (src && resolve(src, NULL, target->addr.ss_family, &target->src,
+				&target->src_len))
+		return -1;
+	return 0;
+}
+
+/*
+ * A count between 1 and max, rounded up to a power of 2. Returns 0 if
+ * the argument is not one.
+ */
+static int parse_pow2(char *arg, long max, const char *what)
+{
+	long n, res = 1;
+	char *end;
+
+	errno = 0;
+	n = strtol(arg, &end, 10);
+	if (errno || (end == arg) || *end || (n < 1) || (n > max)) {
+		lancet_fprintf(stderr, "%s must be between 1 and %ld\n", what, max);
+		return 0;
+	}
+	while (res < n)
+		res <<= 1;
+	return res;
+}
+
 struct agent_config *parse_arguments(int argc, char **argv)
 {
-	int c, agent_type;
+	int c, agent_type, i, weight_count = 0;
 	struct agent_config *cfg;
-	char *token1, *token2;
-	struct sockaddr_in sa;
+	char *token1, *idist_spec = NULL, *sched_spec = NULL;
 	//char proto[128];
 
 	cfg = calloc(1, sizeof(struct agent_config));
@@ -48,23 +155,23 @@ struct agent_config *parse_arguments(int argc, char **argv)
 		lancet_fprintf(stderr, "Failed to allocate cfg\n");
 		return NULL;
 	}
+	cfg->max_pending = DEFAULT_PENDING_REQS;
+	cfg->rx_buf_size = DEFAULT_RX_BUF;
 
-	while ((c = getopt(argc, argv, "t:s:c:a:p:i:r:")) != -1) {
+	while ((c = getopt(argc, argv, "t:s:c:a:p:i:r:o:b:n:d:l:C:m:PL:T:")) != -1) {
 		switch (c) {
 		case 't':
 			// Thread count
 			cfg->thread_count = atoi(optarg);
 			break;
 		case 's':
-			// Targets ip:port,ip:port
+			// Targets host:port[@source],unix:path,vsock:cid:port
 			token1 = strtok_r(optarg, ",", &optarg);
 			while (token1) {
 				/* Prepare the target */
-				token2 = strtok_r(token1, ":", &token1);
-				inet_pton(AF_INET, token2, &(sa.sin_addr));
-				cfg->targets[cfg->target_count].ip = sa.sin_addr.s_addr;
-				token2 = strtok_r(token1, ":", &token1);
-				cfg->targets[cfg->target_count++].port = atoi(token2);
+				if (parse_target(token1,
+							&cfg->targets[cfg->target_count++]))
+					return NULL;
 
 				assert(cfg->target_count < 4096);
 				token1 = strtok_r(optarg, ",", &optarg);
@@ -85,6 +192,10 @@ struct agent_config *parse_arguments(int argc, char **argv)
 				cfg->atype = SYMMETRIC_NIC_TIMESTAMP_AGENT;
 			else if (agent_type == SYMMETRIC_AGENT)
 				cfg->atype = SYMMETRIC_AGENT;
+			else if (agent_type == CONNECT_AGENT)
+				cfg->atype = CONNECT_AGENT;
+			else if (agent_type == SYMMETRIC_SW_TIMESTAMP_AGENT)
+				cfg->atype = SYMMETRIC_SW_TIMESTAMP_AGENT;
 			else {
 				lancet_fprintf(stderr, "Unknown agent type\n");
 				return NULL;
@@ -103,6 +214,7 @@ struct agent_config *parse_arguments(int argc, char **argv)
 			break;
 		case 'i':
 			// Interarrival distribution
+			idist_spec = strdup(optarg);
 			cfg->idist = init_rand(optarg);
 			init_reference_ia_dist(init_rand(optarg));
 			if (!cfg->idist) {
@@ -118,6 +230,81 @@ struct agent_config *parse_arguments(int argc, char **argv)
 				return NULL;
 			}
 			break;
+		case 'o':
+			// Dump every sample to a binary file
+			cfg->dump_path = optarg;
+			break;
+		case 'n':
+			// Interface to timestamp on and bind the connections to
+			cfg->if_name = optarg;
+			break;
+		case 'd':
+			// Outstanding requests per connection
+			cfg->max_pending = parse_pow2(optarg, 1 << 15,
+					"Outstanding requests");
+			if (!cfg->max_pending)
+				return NULL;
+			break;
+		case 'l':
+			// Receive buffer bytes per connection
+			cfg->rx_buf_size = parse_pow2(optarg, 1 << 30,
+					"Receive buffer size");
+			if (!cfg->rx_buf_size)
+				return NULL;
+			break;
+		case 'C':
+			// Thread placement seq|core|nic|list:<cpulist>
+			cfg->placement = optarg;
+			break;
+		case 'm':
+			// CPUs reserved for the manager
+			cfg->manager_cpus = optarg;
+			break;
+		case 'P':
+			// Per-thread hardware counters over the measurement
+			cfg->perf_counters = 1;
+			break;
+		case 'L':
+			// Load schedule over the START_LOAD rate, see load_sched.h
+			sched_spec = strdup(optarg);
+			cfg->load_sched = init_load_sched(optarg);
+			if (!cfg->load_sched)
+				return NULL;
+			break;
+		case 'T':
+			// Tenant, repeated for every group of targets
+			if (cfg->tenant_count == MAX_TENANTS) {
+				lancet_fprintf(stderr, "Too many tenants\n");
+				return NULL;
+			}
+			if (parse_tenant(optarg, &cfg->tenants[cfg->tenant_count++]))
+				return NULL;
+			break;
+		case 'b':
+			// Connection selection random|rr|least|weighted:w0,w1,...
+			token1 = strtok_r(optarg, ":", &optarg);
+			if (!strcmp(token1, "random"))
+				cfg->policy = POLICY_RANDOM;
+			else if (!strcmp(token1, "rr"))
+				cfg->policy = POLICY_ROUND_ROBIN;
+			else if (!strcmp(token1, "least"))
+				cfg->policy = POLICY_LEAST_OUTSTANDING;
+			else if (!strcmp(token1, "weighted")) {
+				cfg->policy = POLICY_WEIGHTED;
+				token1 = strtok_r(optarg, ",", &optarg);
+				while (token1) {
+					if (weight_count == 4096) {
+						lancet_fprintf(stderr, "Too many target weights\n");
+						return NULL;
+					}
+					cfg->target_weights[weight_count++] = atof(token1);
+					token1 = strtok_r(optarg, ",", &optarg);
+				}
+			} else {
+				lancet_fprintf(stderr, "Unknown connection selection\n");
+				return NULL;
+			}
+			break;
 #if 0
 		case 'l':
 			if (parse_agent_type(optarg))
@@ -130,6 +317,35 @@ struct agent_config *parse_arguments(int argc, char **argv)
 		}
 	}
 
+	if ((cfg->thread_count < 1) || (cfg->conn_count < cfg->thread_count)) {
+		lancet_fprintf(stderr, "Every thread needs a connection\n");
+		return NULL;
+	}
+	if ((cfg->conn_count - 1) / cfg->thread_count >= MAX_THREAD_CONNS) {
+		lancet_fprintf(stderr, "More than %d connections per thread\n",
+				MAX_THREAD_CONNS);
+		return NULL;
+	}
+
+	// Targets without a weight get 1
+	for (i = weight_count; i < cfg->target_count; i++)
+		cfg->target_weights[i] = 1;
+
+	if (cfg->tenant_count) {
+		// A tenant runs its own arrivals and picks its connections at random
+		if ((cfg->atype == LATENCY_AGENT) || (cfg->atype == CONNECT_AGENT)) {
+			lancet_fprintf(stderr, "Tenants need an open-loop agent\n");
+			return NULL;
+		}
+		if (cfg->policy != POLICY_RANDOM) {
+			lancet_fprintf(stderr, "Tenants pick their connections at random, only -b random\n");
+			return NULL;
+		}
+		if (init_tenants(cfg->tenants, cfg->tenant_count, cfg->target_count,
+					cfg->app_proto, idist_spec, sched_spec))
+			return NULL;
+	}
+
 	cfg->tp = init_transport_protocol(cfg->tp_type);
 	if (!cfg->tp) {
 		lancet_fprintf(stderr, "Failed to init transport\n");
@@ -0,0 +1,342 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <lancet/agent.h>
+#include <lancet/conn_select.h>
+#include <lancet/error.h>
+
+/*
+ * A dense set of connection indices. Every connection stores its
+ * position in the set, so adding and removing are O(1).
+ */
+struct conn_set {
+	uint16_t *conns;
+	int count;
+};
+
+#define SELECT_POS offsetof(struct tcp_connection, select_pos)
+#define GROUP_POS offsetof(struct tcp_connection, group_pos)
+#define TENANT_POS offsetof(struct tcp_connection, tenant_pos)
+
+static __thread struct tcp_connection *connections;
+static __thread enum conn_policy policy;
+static __thread struct conn_set selectable;
+/* By target for weighted */
+static __thread struct conn_set *groups;
+static __thread int group_count;
+static __thread int max_pending;
+static __thread uint32_t rr_cursor;
+/*
+ * For least, every connection sorted by level: level 0 are the closed
+ * ones, level p+1 the open ones with p outstanding requests and the last
+ * level the full ones. Level l spans least_start[l] to least_start[l+1],
+ * so the least loaded group starts at least_start[1].
+ */
+static __thread uint16_t *least_order;
+static __thread int *least_start;
+static __thread struct conn_set *tenant_sets;
+/* Walker's alias table over the targets, for weighted */
+static __thread double *alias_prob;
+static __thread uint32_t *alias;
+
+static inline uint16_t *conn_pos(uint16_t idx, size_t off)
+{
+	return (uint16_t *)((char *)&connections[idx] + off);
+}
+
+static inline void set_add(struct conn_set *set, uint16_t idx, size_t off)
+{
+	*conn_pos(idx, off) = set->count;
+	set->conns[set->count++] = idx;
+}
+
+static inline void set_remove(struct conn_set *set, uint16_t idx, size_t off)
+{
+	uint16_t pos, last;
+
+	pos = *conn_pos(idx, off);
+	last = set->conns[--set->count];
+	set->conns[pos] = last;
+	*conn_pos(last, off) = pos;
+	*conn_pos(idx, off) = NOT_SELECTABLE;
+}
+
+static inline struct tcp_connection *set_pick(struct conn_set *set)
+{
+	return &connections[set->conns[rand() % set->count]];
+}
+
+static inline void least_swap(int a, int b)
+{
+	uint16_t idx = least_order[a];
+
+	least_order[a] = least_order[b];
+	least_order[b] = idx;
+	connections[least_order[a]].group_pos = a;
+	connections[least_order[b]].group_pos = b;
+}
+
+/*
+ * The connection moves one level at a time, swapping with the edge of
+ * every level it crosses. A send moves it up a single level, so the
+ * moves are O(1) amortized.
+ */
+static void least_move(struct tcp_connection *conn, int level)
+{
+	int l = conn->group;
+
+	for (; l < level; l++)
+		least_swap(conn->group_pos, --least_start[l + 1]);
+	for (; l > level; l--)
+		least_swap(conn->group_pos, least_start[l]++);
+	conn->group = level;
+}
+
+static int init_least(int count)
+{
+	int i;
+
+	least_order = malloc(count * sizeof(uint16_t));
+	least_start = malloc((max_pending + 3) * sizeof(int));
+	if (!least_order || !least_start)
+		return -1;
+	for (i = 0; i < count; i++) {
+		least_order[i] = i;
+		connections[i].group_pos = i;
+		connections[i].group = 0;
+	}
+	least_start[0] = 0;
+	for (i = 1; i < max_pending + 3; i++)
+		least_start[i] = count;
+	return 0;
+}
+
+static int init_alias(double *weights, int n)
+{
+	double sum = 0, *scaled;
+	int i, s, l, small_count = 0, large_count = 0;
+	int *small, *large;
+
+	alias_prob = malloc(n * sizeof(double));
+	alias = malloc(n * sizeof(uint32_t));
+	scaled = malloc(n * sizeof(double));
+	small = malloc(n * sizeof(int));
+	large = malloc(n * sizeof(int));
+	if (!alias_prob || !alias || !scaled || !small || !large)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		sum += weights[i];
+	for (i = 0; i < n; i++) {
+		scaled[i] = sum > 0 ? weights[i] * n / sum : 1;
+		alias[i] = i;
+		if (scaled[i] < 1)
+			small[small_count++] = i;
+		else
+			large[large_count++] = i;
+	}
+	while (small_count && large_count) {
+		s = small[--small_count];
+		l = large[--large_count];
+		alias_prob[s] = scaled[s];
+		alias[s] = l;
+		scaled[l] -= 1 - scaled[s];
+		if (scaled[l] < 1)
+			small[small_count++] = l;
+		else
+			large[large_count++] = l;
+	}
+	while (large_count)
+		alias_prob[large[--large_count]] = 1;
+	while (small_count)
+		alias_prob[small[--small_count]] = 1;
+
+	free(scaled);
+	free(small);
+	free(large);
+	return 0;
+}
+
+/*
+ * Every tenant needs a connection on every thread
+ */
+static int init_tenant_sets(struct tcp_connection *conns, int count)
+{
+	int i, tenant_count = get_tenant_count();
+	int *size;
+
+	tenant_sets = calloc(tenant_count, sizeof(struct conn_set));
+	size = calloc(tenant_count, sizeof(int));
+	if (!tenant_sets || !size)
+		goto err;
+	for (i = 0; i < count; i++) {
+		conns[i].tenant = get_target_tenant(conns[i].target);
+		conns[i].tenant_pos = NOT_SELECTABLE;
+		size[conns[i].tenant]++;
+	}
+	for (i = 0; i < tenant_count; i++) {
+		if (!size[i]) {
+			lancet_fprintf(stderr, "Thread %d has no connection to "
+					"tenant %d, raise -c\n", get_agent_tid(), i);
+			goto err;
+		}
+		tenant_sets[i].conns = malloc(size[i] * sizeof(uint16_t));
+		if (!tenant_sets[i].conns)
+			goto err;
+	}
+	free(size);
+	return 0;
+err:
+	free(size);
+	return -1;
+}
+
+/*
+ * The targets of the connections must be set
+ */
+int select_init(struct tcp_connection *conns, int count)
+{
+	int i, *group_size;
+
+	connections = conns;
+	policy = get_conn_policy();
+	max_pending = get_max_pending();
+	selectable.conns = malloc(count * sizeof(uint16_t));
+	if (!selectable.conns)
+		goto err;
+	for (i = 0; i < count; i++) {
+		conns[i].select_pos = NOT_SELECTABLE;
+		conns[i].group_pos = NOT_SELECTABLE;
+	}
+	if (get_tenant_count() && init_tenant_sets(conns, count))
+		return -1;
+
+	if (policy == POLICY_LEAST_OUTSTANDING) {
+		if (init_least(count))
+			goto err;
+		return 0;
+	} else if (policy != POLICY_WEIGHTED)
+		return 0;
+
+	group_count = get_target_count();
+	groups = calloc(group_count, sizeof(struct conn_set));
+	group_size = calloc(group_count, sizeof(int));
+	if (!groups || !group_size)
+		goto err;
+	for (i = 0; i < count; i++)
+		group_size[conns[i].target]++;
+	for (i = 0; i < group_count; i++) {
+		if (!group_size[i])
+			continue;
+		groups[i].conns = malloc(group_size[i] * sizeof(uint16_t));
+		if (!groups[i].conns)
+			goto err;
+	}
+	free(group_size);
+
+	if ((policy == POLICY_WEIGHTED) &&
+			init_alias(get_target_weights(), group_count))
+		goto err;
+	return 0;
+err:
+	lancet_fprintf(stderr, "Failed to allocate connection selection\n");
+	return -1;
+}
+
+/*
+ * Called whenever the state or the outstanding requests of a connection
+ * change
+ */
+void select_update(struct tcp_connection *conn)
+{
+	int group = conn->target;
+
+	if (policy == POLICY_LEAST_OUTSTANDING)
+		least_move(conn, conn->state != CONN_OPEN ? 0 :
+				(conn->pending_reqs < max_pending ?
+				 conn->pending_reqs : max_pending) + 1);
+
+	if ((conn->state != CONN_OPEN) || (conn->pending_reqs >= max_pending)) {
+		if (conn->select_pos == NOT_SELECTABLE)
+			return;
+		set_remove(&selectable, conn->idx, SELECT_POS);
+		if (group_count)
+			set_remove(&groups[conn->group], conn->idx, GROUP_POS);
+		if (tenant_sets)
+			set_remove(&tenant_sets[conn->tenant], conn->idx, TENANT_POS);
+		return;
+	}
+
+	if (conn->select_pos == NOT_SELECTABLE) {
+		set_add(&selectable, conn->idx, SELECT_POS);
+		if (tenant_sets)
+			set_add(&tenant_sets[conn->tenant], conn->idx, TENANT_POS);
+		if (group_count) {
+			conn->group = group;
+			set_add(&groups[group], conn->idx, GROUP_POS);
+		}
+	} else if (group_count && (group != conn->group)) {
+		set_remove(&groups[conn->group], conn->idx, GROUP_POS);
+		conn->group = group;
+		set_add(&groups[group], conn->idx, GROUP_POS);
+	}
+}
+
+struct tcp_connection *select_conn(void)
+{
+	uint32_t t;
+	int first, end;
+
+	if (!selectable.count)
+		return NULL;
+
+	switch (policy) {
+	case POLICY_ROUND_ROBIN:
+		return &connections[selectable.conns[rr_cursor++ % selectable.count]];
+	case POLICY_LEAST_OUTSTANDING:
+		first = least_start[1];
+		end = least_start[connections[least_order[first]].group + 1];
+		return &connections[least_order[first + rand() % (end - first)]];
+	case POLICY_WEIGHTED:
+		t = rand() % group_count;
+		if (rand() >= alias_prob[t] * RAND_MAX)
+			t = alias[t];
+		if (groups[t].count)
+			return set_pick(&groups[t]);
+		/* The target is saturated or down, take any other */
+		return set_pick(&selectable);
+	default:
+		return set_pick(&selectable);
+	}
+}
+
+struct tcp_connection *select_tenant_conn(int tenant)
+{
+	if (!tenant_sets[tenant].count)
+		return NULL;
+	return set_pick(&tenant_sets[tenant]);
+}
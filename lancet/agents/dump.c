@@ -0,0 +1,232 @@
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <lancet/agent.h>
+#include <lancet/dump.h>
+#include <lancet/error.h>
+
+/*
+ * Every agent thread owns a ring made of two halves. The background
+ * writer writes a half to the file once it is complete, so the agent
+ * keeps filling the other one and never waits for the disk. If the
+ * writer falls behind the samples are dropped and counted.
+ */
+#define DUMP_HALF_RECORDS 65536
+#define DUMP_RING_RECORDS (2 * DUMP_HALF_RECORDS)
+
+struct dump_ring {
+	struct sample_record *records;
+	/* Agent side */
+	volatile uint64_t head __attribute__((aligned(64)));
+	uint64_t cached_tail;
+	uint64_t dropped;
+	/* Writer side */
+	volatile uint64_t tail __attribute__((aligned(64)));
+};
+
+static int dump_fd = -1;
+static struct dump_ring **rings;
+static int ring_count;
+static int max_rings;
+static volatile uint64_t flush_req;
+static volatile uint64_t flush_done;
+static __thread struct dump_ring *ring;
+
+static int write_all(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+	char *p = (char *)buf;
+
+	while (len > 0) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Write the complete halves of the ring, or everything if flushing
+ */
+static void drain_ring(struct dump_ring *r, int flush)
+{
+	uint64_t head, start, n;
+
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	while (head - r->tail >= (flush ? 1 : DUMP_HALF_RECORDS)) {
+		start = r->tail % DUMP_RING_RECORDS;
+		n = head - r->tail;
+		if (start + n > DUMP_RING_RECORDS)
+			n = DUMP_RING_RECORDS - start;
+		if (write_all(dump_fd, &r->records[start],
+					n * sizeof(struct sample_record))) {
+			lancet_perror("Error writing sample dump");
+			exit(-1);
+		}
+		__atomic_store_n(&r->tail, r->tail + n, __ATOMIC_RELEASE);
+	}
+}
+
+static void *dump_writer_main(__attribute__((unused)) void *arg)
+{
+	uint64_t req;
+	int i, count;
+
+	while (1) {
+		req = flush_req;
+		count = ring_count;
+		for (i = 0; i < count; i++)
+			if (rings[i])
+				drain_ring(rings[i], req != flush_done);
+		if (req != flush_done) {
+			flush_done = req;
+			continue;
+		}
+		usleep(1000);
+	}
+	return NULL;
+}
+
+int dump_init(char *path)
+{
+	struct dump_file_hdr hdr;
+	pthread_t tid;
+
+	dump_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (dump_fd < 0) {
+		lancet_perror("Error opening sample dump");
+		return -1;
+	}
+
+	hdr.magic = DUMP_MAGIC;
+	hdr.version = DUMP_VERSION;
+	hdr.record_size = sizeof(struct sample_record);
+	hdr.thread_count = get_thread_count();
+	hdr.conn_count = get_conn_count();
+	hdr.target_count = get_target_count();
+	if (write_all(dump_fd, &hdr, sizeof(hdr))) {
+		lancet_perror("Error writing sample dump header");
+		return -1;
+	}
+
+	max_rings = get_thread_count();
+	rings = calloc(max_rings, sizeof(struct dump_ring *));
+	if (!rings) {
+		lancet_fprintf(stderr, "Failed to allocate dump rings\n");
+		return -1;
+	}
+
+	if (pthread_create(&tid, NULL, dump_writer_main, NULL)) {
+		lancet_fprintf(stderr, "failed to spawn dump writer\n");
+		return -1;
+	}
+	pthread_detach(tid);
+
+	return 0;
+}
+
+int dump_thread_init(void)
+{
+	struct dump_ring *r;
+	int idx;
+
+	if (dump_fd < 0)
+		return 0;
+
+	r = aligned_alloc(64, sizeof(struct dump_ring));
+	if (!r)
+		return -1;
+	bzero(r, sizeof(struct dump_ring));
+	r->records = malloc(DUMP_RING_RECORDS * sizeof(struct sample_record));
+	if (!r->records)
+		return -1;
+
+	idx = __sync_fetch_and_add(&ring_count, 1);
+	assert(idx < max_rings);
+	rings[idx] = r;
+	ring = r;
+
+	return 0;
+}
+
+void dump_sample(struct timespec *tx, uint32_t lat, uint32_t conn,
+		uint32_t target)
+{
+	struct sample_record *rec;
+
+	if (!ring)
+		return;
+
+	if (ring->head - ring->cached_tail >= DUMP_RING_RECORDS) {
+		ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (ring->head - ring->cached_tail >= DUMP_RING_RECORDS) {
+			ring->dropped++;
+			return;
+		}
+	}
+
+	rec = &ring->records[ring->head % DUMP_RING_RECORDS];
+	rec->tx = tx ? tx->tv_sec * 1000000000UL + tx->tv_nsec : 0;
+	rec->lat = lat;
+	rec->conn = conn;
+	rec->target = target;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Called by the manager at the end of a measurement. Samples recorded
+ * after the flush go to the file with the next one.
+ */
+void dump_flush(void)
+{
+	uint64_t req, dropped = 0;
+	int i;
+
+	if (dump_fd < 0)
+		return;
+
+	req = __sync_add_and_fetch(&flush_req, 1);
+	while (flush_done < req)
+		usleep(100);
+
+	for (i = 0; i < ring_count; i++)
+		if (rings[i])
+			dropped += rings[i]->dropped;
+	if (dropped)
+		lancet_fprintf(stderr, "Sample dump dropped %lu samples\n", dropped);
+}
@@ -0,0 +1,73 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#include <lancet/hist.h>
+
+/*
+ * Middle of the bucket range
+ */
+uint64_t hist_bucket_value(int bucket)
+{
+	uint64_t low, width;
+	int shift;
+
+	if (bucket < HIST_SUB)
+		return bucket;
+	shift = bucket / HIST_SUB - 1;
+	low = (uint64_t)(HIST_SUB + bucket % HIST_SUB) << shift;
+	width = 1ULL << shift;
+
+	return low + width / 2;
+}
+
+void hist_merge(struct lat_hist *dst, struct lat_hist *src)
+{
+	int i;
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+/*
+ * p in [0,1]
+ */
+uint64_t hist_percentile(struct lat_hist *hist, double p)
+{
+	uint64_t rank, seen = 0;
+	int i;
+
+	if (!hist->count)
+		return 0;
+	rank = (uint64_t)(p * hist->count);
+	if (rank >= hist->count)
+		rank = hist->count - 1;
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen > rank)
+			return hist_bucket_value(i);
+	}
+	return hist_bucket_value(HIST_BUCKETS - 1);
+}
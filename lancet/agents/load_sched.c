@@ -0,0 +1,328 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <lancet/error.h>
+#include <lancet/load_sched.h>
+#include <lancet/misc.h>
+
+/*
+ * Where a thread is in a schedule. Threads only move forward in time,
+ * so finding the segment of a send is O(1) amortized.
+ */
+struct sched_cursor {
+	long epoch; // the start it follows
+	int idx; // count when holding the last factor
+	long begin; // ns since the start
+	long end;
+	unsigned short rng[3];
+};
+
+static __thread struct sched_cursor cursors[SCHED_MAX];
+static int sched_count;
+
+static long sojourn(struct load_sched *s, struct sched_cursor *c, int idx)
+{
+	if (s->type != SCHED_MMPP)
+		return s->seg[idx].duration;
+	return lround(-log(1 - erand48(c->rng)) * s->seg[idx].duration);
+}
+
+static void cursor_reset(struct load_sched *s, struct sched_cursor *c)
+{
+	memcpy(c->rng, s->seed, sizeof(c->rng));
+	c->idx = 0;
+	c->begin = 0;
+	c->end = sojourn(s, c, 0);
+}
+
+static void cursor_advance(struct load_sched *s, struct sched_cursor *c)
+{
+	int next;
+
+	c->begin = c->end;
+	switch (s->type) {
+	case SCHED_RAMP:
+	case SCHED_STEP:
+		if (++c->idx == s->count) {
+			c->end = LONG_MAX;
+			return;
+		}
+		break;
+	case SCHED_ONOFF:
+		c->idx = (c->idx + 1) % s->count;
+		break;
+	case SCHED_MMPP:
+		next = erand48(c->rng) * (s->count - 1);
+		c->idx = next < c->idx ? next : next + 1;
+		break;
+	default:
+		assert(0);
+	}
+	c->end = c->begin + sojourn(s, c, c->idx);
+}
+
+static long sched_epoch(struct load_sched *s, struct sched_cursor *c)
+{
+	long start = __atomic_load_n(&s->start, __ATOMIC_ACQUIRE);
+
+	if (start != c->epoch) {
+		c->epoch = start;
+		cursor_reset(s, c);
+	}
+	return start;
+}
+
+/*
+ * The factor over [t, *end), t in ns since the start
+ */
+static double sched_piece(struct load_sched *s, struct sched_cursor *c,
+		long t, long *end)
+{
+	struct sched_segment *seg;
+
+	if (s->type == SCHED_SINE) {
+		*end = t + SCHED_RESOLUTION;
+		return 1 + s->amplitude *
+			sin(2 * M_PI * (t % s->period) / (double)s->period);
+	}
+	if (t < c->begin)
+		cursor_reset(s, c);
+	while (t >= c->end)
+		cursor_advance(s, c);
+	if (c->idx == s->count) {
+		*end = LONG_MAX;
+		return s->seg[s->count - 1].to;
+	}
+	seg = &s->seg[c->idx];
+	*end = c->end;
+	if (seg->from == seg->to)
+		return seg->from;
+	if (t + SCHED_RESOLUTION < *end)
+		*end = t + SCHED_RESOLUTION;
+	return seg->from + (seg->to - seg->from) * (t - c->begin) /
+		seg->duration;
+}
+
+/*
+ * Send time of the request after the one at at, ia is the inter-arrival
+ * drawn for the START_LOAD rate. Consumes ia of work at the rate of the
+ * schedule, factors of 0 are skipped.
+ */
+long load_sched_next(struct load_sched *s, long at, long ia)
+{
+	struct sched_cursor *c = &cursors[s->id];
+	long start, t, end;
+	double f, work = ia;
+
+	start = sched_epoch(s, c);
+	t = at > start ? at - start : 0;
+	while (1) {
+		f = sched_piece(s, c, t, &end);
+		if (f > 0) {
+			if (f * (end - t) >= work)
+				return start + t + lround(work / f);
+			work -= f * (end - t);
+		}
+		t = end;
+	}
+}
+
+/*
+ * The mean offered rate over [from, to], time_ns() values
+ */
+double load_sched_rate(struct load_sched *s, long from, long to)
+{
+	struct sched_cursor *c = &cursors[s->id];
+	long start, begin, stop, t, end;
+	double sum = 0;
+
+	start = sched_epoch(s, c);
+	begin = from > start ? from - start : 0;
+	stop = to - start;
+	if (stop <= begin)
+		return s->load * sched_piece(s, c, begin, &end);
+	for (t = begin; t < stop; t = end) {
+		double f = sched_piece(s, c, t, &end);
+
+		if (end > stop)
+			end = stop;
+		sum += f * (end - t);
+	}
+	return s->load * sum / (stop - begin);
+}
+
+void load_sched_start(struct load_sched *s, uint32_t load)
+{
+	s->load = load;
+	__atomic_store_n(&s->start, time_ns(), __ATOMIC_RELEASE);
+}
+
+/* <f>:<sec>,<f>:<sec>,... */
+static int parse_segments(struct load_sched *s, char *list)
+{
+	char *pair, *tok;
+
+	pair = strtok_r(list, ",", &list);
+	while (pair) {
+		if (s->count == SCHED_MAX_SEGMENTS) {
+			lancet_fprintf(stderr, "Too many schedule segments\n");
+			return -1;
+		}
+		tok = strtok_r(pair, ":", &pair);
+		if (!tok || !pair) {
+			lancet_fprintf(stderr, "Schedule segments are <f>:<sec>\n");
+			return -1;
+		}
+		s->seg[s->count].from = s->seg[s->count].to = atof(tok);
+		s->seg[s->count].duration = lround(atof(pair) * 1e9);
+		s->count++;
+		pair = strtok_r(list, ",", &list);
+	}
+	return 0;
+}
+
+static int parse_params(char *list, double *params, int count)
+{
+	char *tok;
+	int i;
+
+	for (i=0;i<count;i++) {
+		tok = strtok_r(list, ":", &list);
+		if (!tok) {
+			lancet_fprintf(stderr, "The schedule needs %d parameters\n",
+					count);
+			return -1;
+		}
+		params[i] = atof(tok);
+	}
+	return 0;
+}
+
+static int check_sched(struct load_sched *s)
+{
+	int i, load = 0;
+
+	if (s->type == SCHED_SINE) {
+		if ((s->amplitude < 0) || (s->amplitude > 1) || (s->period <= 0)) {
+			lancet_fprintf(stderr, "The sine needs an amplitude in [0, 1] and a period\n");
+			return -1;
+		}
+		return 0;
+	}
+	if (!s->count) {
+		lancet_fprintf(stderr, "Empty schedule\n");
+		return -1;
+	}
+	for (i=0;i<s->count;i++) {
+		if ((s->seg[i].from < 0) || (s->seg[i].to < 0) ||
+				(s->seg[i].duration <= 0)) {
+			lancet_fprintf(stderr, "Schedule factors can't be negative, durations must be positive\n");
+			return -1;
+		}
+		load |= (s->seg[i].to > 0);
+	}
+	/* The rest of the run holds the last factor */
+	if (((s->type == SCHED_RAMP) || (s->type == SCHED_STEP)) &&
+			!s->seg[s->count - 1].to) {
+		lancet_fprintf(stderr, "The schedule must end with a load, START_LOAD 0 stops it\n");
+		return -1;
+	}
+	if ((s->type == SCHED_MMPP) && (s->count < 2)) {
+		lancet_fprintf(stderr, "MMPP needs two states\n");
+		return -1;
+	}
+	if (!load) {
+		lancet_fprintf(stderr, "The schedule never sends\n");
+		return -1;
+	}
+	return 0;
+}
+
+struct load_sched *init_load_sched(char *spec)
+{
+	struct load_sched *s;
+	double p[4] = {0};
+	long seed;
+	char *type;
+	int ret;
+
+	if (sched_count == SCHED_MAX) {
+		lancet_fprintf(stderr, "Too many load schedules\n");
+		return NULL;
+	}
+	s = calloc(1, sizeof(struct load_sched));
+	assert(s);
+	type = strtok_r(spec, ":", &spec);
+	if (!type || !spec) {
+		lancet_fprintf(stderr, "Load schedules are <type>:<params>\n");
+		goto fail;
+	}
+	if (!strcmp(type, "ramp")) {
+		s->type = SCHED_RAMP;
+		ret = parse_params(spec, p, 3);
+		s->seg[0].from = p[0];
+		s->seg[0].to = p[1];
+		s->seg[0].duration = lround(p[2] * 1e9);
+		s->count = 1;
+	} else if (!strcmp(type, "step")) {
+		s->type = SCHED_STEP;
+		ret = parse_segments(s, spec);
+	} else if (!strcmp(type, "sine")) {
+		s->type = SCHED_SINE;
+		ret = parse_params(spec, p, 2);
+		s->amplitude = p[0];
+		s->period = lround(p[1] * 1e9);
+	} else if (!strcmp(type, "onoff")) {
+		s->type = SCHED_ONOFF;
+		ret = parse_params(spec, p, 4);
+		s->seg[0].from = s->seg[0].to = p[0];
+		s->seg[0].duration = lround(p[1] * 1e9);
+		s->seg[1].from = s->seg[1].to = p[2];
+		s->seg[1].duration = lround(p[3] * 1e9);
+		s->count = 2;
+	} else if (!strcmp(type, "mmpp")) {
+		s->type = SCHED_MMPP;
+		ret = parse_segments(s, spec);
+	} else {
+		lancet_fprintf(stderr, "Unknown load schedule %s\n", type);
+		goto fail;
+	}
+	if (ret || check_sched(s))
+		goto fail;
+
+	seed = time_ns() + sched_count;
+	memcpy(s->seed, &seed, sizeof(s->seed));
+	s->id = sched_count++;
+	return s;
+fail:
+	free(s);
+	return NULL;
+}
@@ -28,12 +28,17 @@
 #include <pthread.h>
 #include <assert.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #include <netdb.h>
 #include <netinet/in.h>
 
 #include <assert.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/uio.h>
 
 #include <lancet/manager.h>
@@ -42,27 +47,129 @@
 #include <lancet/coord_proto.h>
 #include <lancet/agent.h>
 #include <lancet/misc.h>
+#include <lancet/dump.h>
+#include <lancet/topology.h>
+#include <lancet/perf.h>
 
-static volatile int agents_should_load;
-static volatile int agents_should_measure;
+/*
+ * Phase control. The manager publishes a new phase word, with a new
+ * epoch, and waits until every running thread acknowledged it. A thread
+ * applies the phase the next time it checks should_load(), so after the
+ * acknowledgement no thread writes the stats of the previous phase.
+ */
+#define PHASE_LOAD 1
+#define PHASE_MEASURE 2
+#define PHASE_BUFFER 4
+#define PHASE_FLAGS 7
+#define PHASE_EPOCH 8
+#define PHASE_ACK_TIMEOUT 1000000000L
+
+struct phase_ack {
+	uint32_t phase; // 0 until the thread runs
+} __attribute__((aligned(64)));
+
+static uint32_t phase = PHASE_EPOCH;
+static __thread uint32_t thread_phase;
+static struct phase_ack *acks;
 static long start_measure_time;
 static long stop_measure_time;
+static long interval_start_time; // ns
+static uint32_t offered_load;
 static union stats *agg_stats;
 
+static void phase_sync(void)
+{
+	uint32_t p;
+
+	do {
+		p = __atomic_load_n(&phase, __ATOMIC_SEQ_CST);
+		if ((p ^ thread_phase) & PHASE_BUFFER)
+			use_stats_buffer(!!(p & PHASE_BUFFER));
+		thread_phase = p;
+		__atomic_store_n(&acks[get_agent_tid()].phase, p, __ATOMIC_SEQ_CST);
+	} while (p != __atomic_load_n(&phase, __ATOMIC_SEQ_CST));
+}
+
 int should_load(void)
 {
-	return agents_should_load;
+	if (__atomic_load_n(&phase, __ATOMIC_ACQUIRE) != thread_phase)
+		phase_sync();
+	return thread_phase & PHASE_LOAD;
 }
 
 int should_measure(void)
 {
-	return agents_should_measure;
+	return thread_phase & PHASE_MEASURE;
+}
+
+/*
+ * Block an idle thread until the phase changes or at most timeout ns,
+ * forever if timeout is 0
+ */
+void wait_for_phase(long timeout)
+{
+	struct timespec ts;
+
+	ts.tv_sec = timeout / 1000000000L;
+	ts.tv_nsec = timeout % 1000000000L;
+	syscall(SYS_futex, &phase, FUTEX_WAIT_PRIVATE, thread_phase,
+			timeout ? &ts : NULL, NULL, 0);
+}
+
+/*
+ * Threads still opening their connections apply the phase when they
+ * start, a thread that doesn't acknowledge in time, e.g. blocked on a
+ * reply, is reported
+ */
+static void set_phase(uint32_t flags)
+{
+	uint32_t p, ack;
+	long deadline;
+	int i;
+
+	p = ((phase & ~PHASE_FLAGS) + PHASE_EPOCH) | flags;
+	__atomic_store_n(&phase, p, __ATOMIC_SEQ_CST);
+	syscall(SYS_futex, &phase, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+
+	deadline = time_ns() + PHASE_ACK_TIMEOUT;
+	for (i = 0; i < get_thread_count(); i++) {
+		while (1) {
+			ack = __atomic_load_n(&acks[i].phase, __ATOMIC_SEQ_CST);
+			if (!ack || (ack == p))
+				break;
+			if (time_ns() > deadline) {
+				lancet_fprintf(stderr, "Thread %d didn't acknowledge the "
+						"phase change\n", i);
+				break;
+			}
+			usleep(10);
+		}
+	}
+}
+
+/*
+ * Start the phase on freshly cleared stats
+ */
+static void start_phase(uint32_t flags)
+{
+	if (flip_stats_buffer())
+		flags |= PHASE_BUFFER;
+	set_phase(flags);
 }
 
 int manager_init(int thread_count)
 {
-	agg_stats = malloc(sizeof(union stats) + AGG_SAMPLE_SIZE*sizeof(struct lat_sample));
+	acks = aligned_alloc(64, thread_count * sizeof(struct phase_ack));
+	assert(acks);
+	bzero(acks, thread_count * sizeof(struct phase_ack));
+	if (init_stats_registry(thread_count))
+		return -1;
+	agg_stats = malloc(sizeof(union stats));
 	assert(agg_stats);
+	if (alloc_lat_samples(&agg_stats->lt_s.samples, AGG_SAMPLE_SIZE))
+		return -1;
+	if (init_readiness())
+		return -1;
 
 	return 0;
 }
@@ -151,6 +258,8 @@ static void reply_throughput_stats(int sockfd)
 	data.Tx_bytes = agg_stats->th_s.tx.bytes;
 	data.Req_count = agg_stats->th_s.rx.reqs;
 	data.Duration = duration;
+	data.Reconnects = agg_stats->th_s.reconnects;
+	data.Failed_sends = agg_stats->th_s.failed_sends;
 	iovcnt = 2;
 	iov[0].iov_base = &m1;
 	iov[0].iov_len = sizeof(struct msg1);
@@ -158,7 +267,7 @@ static void reply_throughput_stats(int sockfd)
 	iov[1].iov_len = sizeof(struct throughput_reply);
 	to_send = sizeof(struct msg1) + sizeof(struct throughput_reply);
 
-	if (get_agent_type() == SYMMETRIC_NIC_TIMESTAMP_AGENT) {
+	if (kernel_timestamping(get_agent_type())) {
 		m2.Hdr.MessageType = REPLY;
 		m2.Hdr.MessageLength = 2*sizeof(uint32_t);
 		m2.Info1 = REPLY_IA_COMP;
@@ -196,6 +305,8 @@ static void reply_latency_stats(int sockfd)
 	data.Th_data.Tx_bytes = agg_stats->lt_s.th_s.tx.bytes;
 	data.Th_data.Req_count = agg_stats->lt_s.th_s.rx.reqs;
 	data.Th_data.Duration = duration;
+	data.Th_data.Reconnects = agg_stats->lt_s.th_s.reconnects;
+	data.Th_data.Failed_sends = agg_stats->lt_s.th_s.failed_sends;
 	data.Avg_lat = agg_stats->lt_s.avg_lat;
 	data.P50_i = agg_stats->lt_s.p50_i;
 	data.P50 = agg_stats->lt_s.p50;
@@ -218,10 +329,10 @@ static void reply_latency_stats(int sockfd)
 		sizeof(struct latency_reply);
 	iovcnt = 2;
 
-	conv = compute_convergence(agg_stats->lt_s.samples, agg_stats->lt_s.size);
-	if (get_agent_type() == SYMMETRIC_NIC_TIMESTAMP_AGENT) {
+	conv = compute_convergence(&agg_stats->lt_s);
+	if (kernel_timestamping(get_agent_type())) {
 //#ifndef SINGLE_REQ
-		//conv = compute_convergence(agg_stats->lt_s.samples, agg_stats->lt_s.size);
+		//conv = compute_convergence(&agg_stats->lt_s);
 		pearson_corr = check_iid(&agg_stats->lt_s);
 //#endif
 
@@ -260,6 +371,150 @@ static void reply_latency_stats(int sockfd)
 	assert(n == to_send);
 }
 
+static void reply_target_stats(int sockfd)
+{
+	struct iovec iov[3];
+	struct msg1 m;
+	struct target_reply_hdr hdr;
+	struct target_reply *data;
+	struct target_latency *res;
+	struct target_fairness fairness;
+	int i, n, to_send;
+
+	res = malloc(get_target_count() * sizeof(struct target_latency));
+	data = malloc(get_target_count() * sizeof(struct target_reply));
+	assert(res && data);
+
+	bzero(&hdr, sizeof(struct target_reply_hdr));
+	hdr.Target_count = compute_target_stats(res, &fairness);
+	hdr.Max_p99 = fairness.max_p99;
+	hdr.Min_p99 = fairness.min_p99;
+	hdr.Jain_p99 = fairness.jain_p99;
+	hdr.Jain_throughput = fairness.jain_throughput;
+	for (i=0;i<(int)hdr.Target_count;i++) {
+		data[i].Target = res[i].target;
+		data[i].Pad = 0;
+		data[i].Req_count = res[i].count;
+		data[i].Avg_lat = res[i].avg_lat;
+		data[i].P50 = res[i].p50;
+		data[i].P90 = res[i].p90;
+		data[i].P99 = res[i].p99;
+	}
+
+	m.Hdr.MessageType = REPLY;
+	m.Hdr.MessageLength = sizeof(uint32_t) + sizeof(struct target_reply_hdr) +
+		hdr.Target_count * sizeof(struct target_reply);
+	m.Info = REPLY_TARGET_STATS;
+
+	iov[0].iov_base = &m;
+	iov[0].iov_len = sizeof(struct msg1);
+	iov[1].iov_base = &hdr;
+	iov[1].iov_len = sizeof(struct target_reply_hdr);
+	iov[2].iov_base = data;
+	iov[2].iov_len = hdr.Target_count * sizeof(struct target_reply);
+	to_send = sizeof(struct msg_hdr) + m.Hdr.MessageLength;
+
+	n = writev(sockfd, iov, 3);
+	assert(n == to_send);
+	free(res);
+	free(data);
+}
+
+static void reply_connect_stats(int sockfd)
+{
+	struct iovec iov[3];
+	struct msg1 m;
+	struct connect_reply data;
+	struct connect_stats cs;
+	struct hist_bucket_reply buckets[HIST_BUCKETS];
+	int i, n, to_send;
+
+	aggregate_connect_stats(&cs);
+
+	bzero(&data, sizeof(struct connect_reply));
+	data.Connects = cs.hist.count;
+	data.Connect_errors = cs.connect_errors;
+	data.Request_errors = cs.request_errors;
+	data.Duration = stop_measure_time - start_measure_time;
+	data.Avg_lat = cs.hist.count ? cs.hist.sum / cs.hist.count : 0;
+	data.P50 = hist_percentile(&cs.hist, 0.50);
+	data.P90 = hist_percentile(&cs.hist, 0.90);
+	data.P99 = hist_percentile(&cs.hist, 0.99);
+	data.P999 = hist_percentile(&cs.hist, 0.999);
+	for (i=0;i<HIST_BUCKETS;i++) {
+		if (!cs.hist.buckets[i])
+			continue;
+		buckets[data.Bucket_count].Value = hist_bucket_value(i);
+		buckets[data.Bucket_count].Count = cs.hist.buckets[i];
+		data.Bucket_count++;
+	}
+
+	m.Hdr.MessageType = REPLY;
+	m.Hdr.MessageLength = sizeof(uint32_t) + sizeof(struct connect_reply) +
+		data.Bucket_count * sizeof(struct hist_bucket_reply);
+	m.Info = REPLY_CONNECT_STATS;
+
+	iov[0].iov_base = &m;
+	iov[0].iov_len = sizeof(struct msg1);
+	iov[1].iov_base = &data;
+	iov[1].iov_len = sizeof(struct connect_reply);
+	iov[2].iov_base = buckets;
+	iov[2].iov_len = data.Bucket_count * sizeof(struct hist_bucket_reply);
+	to_send = sizeof(struct msg_hdr) + m.Hdr.MessageLength;
+
+	n = writev(sockfd, iov, 3);
+	assert(n == to_send);
+}
+
+/*
+ * Answered at any time, even while the agents are still connecting
+ */
+static void reply_readiness(int sockfd)
+{
+	struct iovec iov[3];
+	struct msg1 m;
+	struct readiness_hdr hdr;
+	struct target_readiness_reply *data;
+	struct target_readiness *r;
+	long elapsed;
+	int i, n, to_send;
+
+	data = malloc(get_target_count() * sizeof(struct target_readiness_reply));
+	assert(data);
+
+	r = get_readiness(&elapsed);
+	hdr.Target_count = get_target_count();
+	hdr.Ready_targets = 0;
+	hdr.Elapsed = elapsed;
+	for (i=0;i<get_target_count();i++) {
+		data[i].Target = i;
+		data[i].Conns = r[i].conns;
+		data[i].Ready = r[i].ready;
+		data[i].Retries = r[i].retries;
+		data[i].First_ready = r[i].first_ready;
+		data[i].All_ready = r[i].all_ready;
+		if (r[i].ready == r[i].conns)
+			hdr.Ready_targets++;
+	}
+
+	m.Hdr.MessageType = REPLY;
+	m.Hdr.MessageLength = sizeof(uint32_t) + sizeof(struct readiness_hdr) +
+		hdr.Target_count * sizeof(struct target_readiness_reply);
+	m.Info = REPLY_READINESS;
+
+	iov[0].iov_base = &m;
+	iov[0].iov_len = sizeof(struct msg1);
+	iov[1].iov_base = &hdr;
+	iov[1].iov_len = sizeof(struct readiness_hdr);
+	iov[2].iov_base = data;
+	iov[2].iov_len = hdr.Target_count * sizeof(struct target_readiness_reply);
+	to_send = sizeof(struct msg_hdr) + m.Hdr.MessageLength;
+
+	n = writev(sockfd, iov, 3);
+	assert(n == to_send);
+	free(data);
+}
+
 static void reply_ack(int sockfd)
 {
 	int n;
@@ -277,12 +532,156 @@ static void reply_ack(int sockfd)
 	assert(n == (sizeof(struct msg_hdr) + sizeof(uint32_t)));
 }
 
+/*
+ * The loop telemetry of every thread. Doesn't interrupt the measurement,
+ * the counters are read while the threads update them.
+ */
+static void reply_telemetry(int sockfd)
+{
+	struct iovec iov[3];
+	struct msg1 m;
+	struct telemetry_hdr hdr;
+	struct thread_telemetry_reply *data;
+	struct loop_stats *ls;
+	int i, n, to_send;
+
+	data = calloc(get_thread_count(), sizeof(struct thread_telemetry_reply));
+	assert(data);
+
+	hdr.Thread_count = get_thread_count();
+	hdr.Pad = 0;
+	hdr.Duration = time_us() - start_measure_time;
+	for (i=0;i<get_thread_count();i++) {
+		data[i].Thread = i;
+		data[i].Node = placement_node(i);
+		ls = get_loop_stats(i);
+		if (!ls)
+			continue;
+		data[i].Iterations = ls->iterations;
+		data[i].Idle_iterations = ls->idle_iterations;
+		data[i].Sends = ls->sends;
+		data[i].Wakeups = ls->wakeups;
+		data[i].Events = ls->events;
+		data[i].Pick_failures = ls->pick_failures;
+		data[i].Window_full = ls->window_full;
+		data[i].Lag_avg = ls->lag.count ? ls->lag.sum / ls->lag.count : 0;
+		data[i].Lag_p99 = hist_percentile(&ls->lag, 0.99);
+		data[i].Lag_p999 = hist_percentile(&ls->lag, 0.999);
+	}
+
+	m.Hdr.MessageType = REPLY;
+	m.Hdr.MessageLength = sizeof(uint32_t) + sizeof(struct telemetry_hdr) +
+		hdr.Thread_count * sizeof(struct thread_telemetry_reply);
+	m.Info = REPLY_TELEMETRY;
+
+	iov[0].iov_base = &m;
+	iov[0].iov_len = sizeof(struct msg1);
+	iov[1].iov_base = &hdr;
+	iov[1].iov_len = sizeof(struct telemetry_hdr);
+	iov[2].iov_base = data;
+	iov[2].iov_len = hdr.Thread_count * sizeof(struct thread_telemetry_reply);
+	to_send = sizeof(struct msg_hdr) + m.Hdr.MessageLength;
+
+	n = writev(sockfd, iov, 3);
+	assert(n == to_send);
+	free(data);
+}
+
+/*
+ * The hardware counters of every thread over the measurement, the
+ * coordinator divides them by the requests
+ */
+static void reply_counters(int sockfd)
+{
+	struct iovec iov[3];
+	struct msg1 m;
+	struct counters_hdr hdr;
+	struct thread_counters_reply *data;
+	uint64_t values[PERF_COUNTER_NR], requests;
+	int i, n, to_send;
+
+	data = calloc(get_thread_count(), sizeof(struct thread_counters_reply));
+	assert(data);
+
+	hdr.Thread_count = get_thread_count();
+	hdr.Available = 0;
+	hdr.Duration = stop_measure_time - start_measure_time;
+	for (i=0;i<get_thread_count();i++) {
+		data[i].Thread = i;
+		hdr.Available |= read_perf_counters(i, values, &requests);
+		data[i].Requests = requests;
+		data[i].Cycles = values[PERF_CYCLES];
+		data[i].Instructions = values[PERF_INSTRUCTIONS];
+		data[i].Cache_misses = values[PERF_CACHE_MISSES];
+		data[i].Branch_misses = values[PERF_BRANCH_MISSES];
+		data[i].Context_switches = values[PERF_CONTEXT_SWITCHES];
+	}
+
+	m.Hdr.MessageType = REPLY;
+	m.Hdr.MessageLength = sizeof(uint32_t) + sizeof(struct counters_hdr) +
+		hdr.Thread_count * sizeof(struct thread_counters_reply);
+	m.Info = REPLY_COUNTERS;
+
+	iov[0].iov_base = &m;
+	iov[0].iov_len = sizeof(struct msg1);
+	iov[1].iov_base = &hdr;
+	iov[1].iov_len = sizeof(struct counters_hdr);
+	iov[2].iov_base = data;
+	iov[2].iov_len = hdr.Thread_count * sizeof(struct thread_counters_reply);
+	to_send = sizeof(struct msg_hdr) + m.Hdr.MessageLength;
+
+	n = writev(sockfd, iov, 3);
+	assert(n == to_send);
+	free(data);
+}
+
+/*
+ * Throughput and latency since the previous interval, for the
+ * coordinator to tell when the load reached a steady state. Doesn't
+ * interrupt the measurement.
+ */
+static void reply_interval(int sockfd)
+{
+	struct iovec iov[2];
+	struct msg1 m;
+	struct interval_reply data;
+	struct interval_stats agg;
+	long now;
+	int n;
+
+	now = time_ns();
+	aggregate_interval_stats(&agg);
+	data.Duration = (now - interval_start_time) / 1000;
+	data.Offered = offered_load ? lround(get_offered_rate(offered_load,
+				interval_start_time, now)) : 0;
+	interval_start_time = now;
+	data.Tx_count = agg.sent;
+	data.Req_count = agg.reqs;
+	data.Lat_count = agg.lat.count;
+	data.Avg_lat = agg.lat.count ? agg.lat.sum / agg.lat.count : 0;
+	data.P50 = hist_percentile(&agg.lat, 0.5);
+	data.P99 = hist_percentile(&agg.lat, 0.99);
+
+	m.Hdr.MessageType = REPLY;
+	m.Hdr.MessageLength = sizeof(uint32_t) + sizeof(struct interval_reply);
+	m.Info = REPLY_INTERVAL;
+
+	iov[0].iov_base = &m;
+	iov[0].iov_len = sizeof(struct msg1);
+	iov[1].iov_base = &data;
+	iov[1].iov_len = sizeof(struct interval_reply);
+
+	n = writev(sockfd, iov, 2);
+	assert(n == sizeof(struct msg1) + sizeof(struct interval_reply));
+}
+
 int manager_run(void)
 {
 	int sockfd, newsockfd, n;
 	struct msg_hdr hdr;
 	int payload1;
 	double sampling;
+	struct interval_stats agg;
 
 	sockfd = create_socket();
 	if (sockfd < 0)
@@ -307,10 +706,14 @@ int manager_run(void)
 			case START_LOAD:
 				n = read(newsockfd, &payload1, sizeof(uint32_t));
 				assert(n == sizeof(uint32_t));
-				set_load(payload1);
-				agents_should_measure = 0;
-				clear_all_stats();
-				agents_should_load = 1;
+				/* A load of 0 stops the load, the threads block */
+				if (payload1)
+					set_load(payload1);
+				start_phase(payload1 ? PHASE_LOAD : 0);
+				offered_load = payload1;
+				/* The first interval starts with the new load */
+				aggregate_interval_stats(&agg);
+				interval_start_time = time_ns();
 				reply_ack(newsockfd);
 				break;
 			case START_MEASURE:
@@ -318,10 +721,11 @@ int manager_run(void)
 				assert(n == sizeof(uint32_t));
 				n = read(newsockfd, &sampling, sizeof(double));
 				assert(n == sizeof(double));
-				clear_all_stats();
 				set_per_thread_samples(lround(1.01*payload1/get_thread_count()), sampling);
 				start_measure_time = time_us();
-				agents_should_measure = 1;
+				control_perf_counters(PERF_EVENT_IOC_RESET);
+				start_phase((phase & PHASE_LOAD) | PHASE_MEASURE);
+				control_perf_counters(PERF_EVENT_IOC_ENABLE);
 				reply_ack(newsockfd);
 				// prepare reference_ia for the ks test
 				collect_reference_ia(get_ia_gen());
@@ -329,14 +733,35 @@ int manager_run(void)
 			case REPORT_REQ:
 				n = read(newsockfd, &payload1, sizeof(uint32_t));
 				assert(n == sizeof(uint32_t));
-				if (agents_should_measure) {
-					agents_should_measure = 0;
+				// Doesn't interrupt the measurement
+				if (payload1 == REPORT_READINESS) {
+					reply_readiness(newsockfd);
+					break;
+				}
+				if (payload1 == REPORT_TELEMETRY) {
+					reply_telemetry(newsockfd);
+					break;
+				}
+				if (payload1 == REPORT_INTERVAL) {
+					reply_interval(newsockfd);
+					break;
+				}
+				if (phase & PHASE_MEASURE) {
+					set_phase(phase & (PHASE_LOAD | PHASE_BUFFER));
+					control_perf_counters(PERF_EVENT_IOC_DISABLE);
 					stop_measure_time = time_us();
+					dump_flush();
 				}
 				if (payload1 == REPORT_THROUGHPUT)
 					reply_throughput_stats(newsockfd);
 				else if (payload1 == REPORT_LATENCY)
 					reply_latency_stats(newsockfd);
+				else if (payload1 == REPORT_TARGETS)
+					reply_target_stats(newsockfd);
+				else if (payload1 == REPORT_CONNECT)
+					reply_connect_stats(newsockfd);
+				else if (payload1 == REPORT_COUNTERS)
+					reply_counters(newsockfd);
 #if 0
 				else if (payload1 == REPORT_CONVERGENCE)
 					reply_conv_stats(newsockfd);
@@ -345,7 +770,8 @@ int manager_run(void)
 					lancet_fprintf(stderr, "Unknown report  message\n");
 					return -1;
 				}
-				agents_should_measure = 1;
+				set_phase((phase & PHASE_FLAGS) | PHASE_MEASURE);
+				control_perf_counters(PERF_EVENT_IOC_ENABLE);
 				break;
 			default:
 				lancet_fprintf(stderr, "Unknown message\n");
@@ -54,6 +54,7 @@ static void fixed_init(struct rand_gen *gen, struct param_1 *param)
 	gen->set_avg = fixed_set_avg;
 	gen->inv_cdf = fixed_inv_cdf;
 	gen->generate = NULL;
+	gen->kind = RAND_FIXED;
 
 	gen->set_avg(gen, param->a);
 	free(param);
@@ -81,6 +82,7 @@ static void exp_init(struct rand_gen *gen, struct param_1 *param)
 	gen->params = malloc(sizeof(double));
 	gen->set_avg = exp_set_avg;
 	gen->inv_cdf = exp_inv_cdf;
+	gen->kind = RAND_EXP;
 	gen->generate = NULL;
 
 	gen->set_avg(gen, param->a);
@@ -123,7 +125,7 @@ static double gev_inv_cdf(struct rand_gen *gen, double y)
 {
 	struct param_lss *params = (struct param_lss *)gen->params;
 	return params->loc +
-		   params->scale * (pow(-exp(y), -params->shape) - 1) / params->shape;
+		   params->scale * (pow(-log(y), -params->shape) - 1) / params->shape;
 }
 
 /*
@@ -303,6 +305,7 @@ struct rand_gen *init_rand(char *gen_type)
 {
 	struct rand_gen *gen = malloc(sizeof(struct rand_gen));
 
+	gen->kind = RAND_GENERIC;
 	if (strncmp(gen_type, "fixed", 5) == 0)
 		fixed_init(gen, parse_param_1(gen_type));
 	else if (strncmp(gen_type, "exp", 3) == 0)
@@ -0,0 +1,208 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <lancet/error.h>
+#include <lancet/sort.h>
+
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MASK (RADIX_BUCKETS - 1)
+#define RADIX_MAX_PASSES ((64 + RADIX_BITS - 1) / RADIX_BITS)
+/* Below that spawning threads costs more than it saves */
+#define PARALLEL_SORT_MIN 65536
+
+struct radix_job {
+	uint64_t *keys;
+	uint64_t *scratch;
+	uint32_t count;
+	int workers;
+	int passes;
+	int shifts[RADIX_MAX_PASSES];
+	pthread_barrier_t barrier;
+	uint32_t hist[MAX_SORT_WORKERS][RADIX_BUCKETS];
+};
+
+struct radix_worker {
+	struct radix_job *job;
+	int id;
+};
+
+/* The idle CPUs of the workers after the caller, none if not pinned */
+static int sort_cpus[MAX_SORT_WORKERS - 1];
+static int sort_cpu_count = -1;
+
+/*
+ * Every worker owns a contiguous chunk of the input. For each digit it
+ * builds a histogram of its chunk, worker 0 turns all histograms into
+ * output offsets (bucket-major, worker-minor to keep the sort stable)
+ * and then every worker scatters its own chunk.
+ */
+static void *radix_worker_main(void *arg)
+{
+	struct radix_worker *w = (struct radix_worker *)arg;
+	struct radix_job *job = w->job;
+	uint64_t *src, *dst, *tmp;
+	uint32_t lo, hi, i, b, c, sum, *hist;
+	int p, j, shift;
+
+	lo = (uint64_t)job->count * w->id / job->workers;
+	hi = (uint64_t)job->count * (w->id + 1) / job->workers;
+	hist = job->hist[w->id];
+	src = job->keys;
+	dst = job->scratch;
+
+	for (p = 0; p < job->passes; p++) {
+		shift = job->shifts[p];
+		memset(hist, 0, RADIX_BUCKETS * sizeof(uint32_t));
+		for (i = lo; i < hi; i++)
+			hist[(src[i] >> shift) & RADIX_MASK]++;
+		pthread_barrier_wait(&job->barrier);
+
+		if (w->id == 0) {
+			sum = 0;
+			for (b = 0; b < RADIX_BUCKETS; b++) {
+				for (j = 0; j < job->workers; j++) {
+					c = job->hist[j][b];
+					job->hist[j][b] = sum;
+					sum += c;
+				}
+			}
+		}
+		pthread_barrier_wait(&job->barrier);
+
+		for (i = lo; i < hi; i++)
+			dst[hist[(src[i] >> shift) & RADIX_MASK]++] = src[i];
+		pthread_barrier_wait(&job->barrier);
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	/* An odd number of passes leaves the result in scratch */
+	if (src != job->keys)
+		memcpy(&job->keys[lo], &src[lo], (hi - lo) * sizeof(uint64_t));
+
+	return NULL;
+}
+
+void radix_sort(uint64_t *keys, uint64_t *scratch, uint32_t count,
+		int workers)
+{
+	struct radix_job *job;
+	struct radix_worker w[MAX_SORT_WORKERS];
+	pthread_t tids[MAX_SORT_WORKERS];
+	pthread_attr_t attr;
+	cpu_set_t cpuset;
+	uint64_t all_or = 0, all_and = ~0ULL, varying;
+	uint32_t i;
+	int shift, j;
+
+	if (count < 2)
+		return;
+
+	/* Skip the digits that are the same for all keys */
+	for (i = 0; i < count; i++) {
+		all_or |= keys[i];
+		all_and &= keys[i];
+	}
+	varying = all_or ^ all_and;
+	if (!varying)
+		return;
+
+	job = malloc(sizeof(struct radix_job));
+	assert(job);
+	job->keys = keys;
+	job->scratch = scratch;
+	job->count = count;
+	job->passes = 0;
+	for (shift = 0; shift < 64; shift += RADIX_BITS)
+		if ((varying >> shift) & RADIX_MASK)
+			job->shifts[job->passes++] = shift;
+
+	if (count < PARALLEL_SORT_MIN || workers < 1)
+		workers = 1;
+	if (workers > MAX_SORT_WORKERS)
+		workers = MAX_SORT_WORKERS;
+	job->workers = workers;
+	pthread_barrier_init(&job->barrier, NULL, workers);
+
+	for (j = 0; j < workers; j++) {
+		w[j].job = job;
+		w[j].id = j;
+	}
+	pthread_attr_init(&attr);
+	for (j = 1; j < workers; j++) {
+		if (sort_cpu_count > 0) {
+			CPU_ZERO(&cpuset);
+			CPU_SET(sort_cpus[(j - 1) % sort_cpu_count], &cpuset);
+			pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
+		}
+		if (pthread_create(&tids[j], &attr, radix_worker_main, &w[j])) {
+			lancet_fprintf(stderr, "failed to spawn sort worker %d\n", j);
+			exit(-1);
+		}
+	}
+	pthread_attr_destroy(&attr);
+	radix_worker_main(&w[0]);
+	for (j = 1; j < workers; j++)
+		pthread_join(tids[j], NULL);
+
+	pthread_barrier_destroy(&job->barrier);
+	free(job);
+}
+
+int idle_sort_workers(int busy_threads)
+{
+	long cpus;
+	int idle;
+
+	if (sort_cpu_count >= 0)
+		return sort_cpu_count + 1;
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	/* The manager thread is busy too, but it is the one sorting */
+	idle = cpus - busy_threads - 1;
+	if (idle < 0)
+		idle = 0;
+	if (idle + 1 > MAX_SORT_WORKERS)
+		return MAX_SORT_WORKERS;
+
+	return idle + 1;
+}
+
+void pin_sort_workers(int *cpus, int count)
+{
+	if (count > MAX_SORT_WORKERS - 1)
+		count = MAX_SORT_WORKERS - 1;
+	memcpy(sort_cpus, cpus, count * sizeof(int));
+	sort_cpu_count = count;
+}
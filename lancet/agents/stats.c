@@ -24,30 +24,88 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <strings.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
 
 #include <lancet/stats.h>
 #include <lancet/agent.h>
 #include <lancet/error.h>
 #include <lancet/manager.h>
+#include <lancet/misc.h>
 #include <lancet/timestamping.h>
+#include <lancet/sort.h>
+#include <lancet/dump.h>
+#include <lancet/topology.h>
+#include <lancet/perf.h>
 
 #define heta 1.96 // for gamma = 0.95
 #define ca 1.858 // for a = 0.001
 
+/*
+ * The stats of a thread are written only by it. The block is cache line
+ * aligned and padded, so the hot counters never share a line with
+ * another thread's data, and allocated after the thread is pinned. seq
+ * is odd while the thread updates the counters, the manager retries its
+ * copy until it sees the same even seq before and after.
+ *
+ * Every thread has two blocks. A measurement starts on the block the
+ * manager cleared while the thread was writing the other one, and the
+ * thread switches to it when it acknowledges the new phase.
+ */
+struct stats_block {
+	uint32_t seq;
+	union stats stats;
+} __attribute__((aligned(64)));
+
+static __thread struct stats_block *thread_blocks;
+static __thread struct stats_block *thread_block;
 static __thread union stats *thread_stats;
-static __thread struct tx_samples tx_s;
+static __thread struct tx_samples *tx_s;
 static __thread uint32_t per_thread_lat_count;
 static int per_thread_samples;
 static double sampling_rate;
-static union stats *all_stats[64];
-static struct tx_samples *all_tx[64];
-static int agent_count = 0;
+static __thread struct lat_hist *target_hists;
+static __thread uint32_t *target_used; // the targets with a sample
+static __thread uint32_t target_used_count;
+static int active_buffer;
+static __thread struct connect_stats *conn_stats;
+static __thread struct loop_stats *loop_s;
+static __thread struct interval_stats *interval_s;
+static struct target_readiness *readiness;
+static long readiness_start;
+
+/*
+ * The stats of every thread by thread id. A thread publishes its entry
+ * with blocks, the readers skip the threads that didn't register yet.
+ * The counters are summed node by node first: node_threads has the
+ * thread ids of node n from node_start[n] to node_start[n+1].
+ */
+struct thread_entry {
+	struct stats_block *blocks;
+	struct tx_samples *tx;
+	struct lat_hist *target_hists;
+	struct connect_stats *conn_stats;
+	struct loop_stats *loop_stats;
+	struct perf_counters *perf; // NULL without -P
+	struct interval_stats *interval;
+};
+
+static struct thread_entry *threads;
+static int thread_count;
+static int *node_threads;
+static int *node_start;
+static int node_count;
+static struct throughput_stats *node_th;
+static struct interval_stats *interval_prev; // at the previous interval
 static uint64_t reference_ia[REFERENCE_IA_SIZE];
 static struct rand_gen *reference_ia_gen;
+static uint64_t *sort_keys;
+static uint64_t *sort_scratch;
+static volatile int64_t tx_base;
 
 void init_reference_ia_dist(struct rand_gen *gen)
 {
@@ -68,6 +126,40 @@ void set_per_thread_samples(int samples, double sr)
 	sampling_rate = sr / 100;
 }
 
+int init_stats_registry(int count)
+{
+	int i, n, pos = 0;
+
+	thread_count = count;
+	node_count = placement_node_count();
+	threads = calloc(count, sizeof(struct thread_entry));
+	node_threads = malloc(count * sizeof(int));
+	node_start = malloc((node_count + 1) * sizeof(int));
+	node_th = malloc(node_count * sizeof(struct throughput_stats));
+	interval_prev = calloc(count, sizeof(struct interval_stats));
+	if (!threads || !node_threads || !node_start || !node_th ||
+			!interval_prev) {
+		lancet_fprintf(stderr, "Failed to allocate the stats registry\n");
+		return -1;
+	}
+	for (n=0;n<node_count;n++) {
+		node_start[n] = pos;
+		for (i=0;i<count;i++)
+			if (placement_node(i) == n)
+				node_threads[pos++] = i;
+	}
+	node_start[node_count] = pos;
+
+	return 0;
+}
+
+static inline struct thread_entry *registered(int thread)
+{
+	if (!__atomic_load_n(&threads[thread].blocks, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &threads[thread];
+}
+
 void clear_stats(union stats *stats)
 {
 	switch (get_agent_type()) {
@@ -76,57 +168,92 @@ void clear_stats(union stats *stats)
 			break;
 		case LATENCY_AGENT:
 		case SYMMETRIC_NIC_TIMESTAMP_AGENT:
+		case SYMMETRIC_SW_TIMESTAMP_AGENT:
 		case SYMMETRIC_AGENT:
-			bzero(stats, sizeof(struct latency_stats));
+		case CONNECT_AGENT:
+			bzero(stats, offsetof(struct latency_stats, samples));
 			break;
 		default:
 			lancet_fprintf(stderr, "Unknonw agent type\n");
 	}
 }
 
-void clear_all_stats(void)
+/*
+ * Clear the idle block of every thread and make it the one reported.
+ * Called by the manager when no thread measures, the threads switch when
+ * they acknowledge the phase with the returned buffer.
+ */
+int flip_stats_buffer(void)
 {
+	struct thread_entry *e;
 	int i;
 
-	for (i=0;i<agent_count;i++) {
-		clear_stats(all_stats[i]);
-		// clear tx samples too
-		all_tx[i]->count = 0;
-	}
+	active_buffer ^= 1;
+	for (i=0;i<thread_count;i++)
+		if ((e = registered(i)))
+			clear_stats(&e->blocks[active_buffer].stats);
+	tx_base = 0;
+
+	return active_buffer;
 }
 
-static int long_compare(const void *arg1, const void *arg2)
+/*
+ * Called by the thread on its phase change. The rest of its stats are
+ * only written by it, so it clears them itself.
+ */
+void use_stats_buffer(int buffer)
 {
-	return (*(const uint64_t *)arg1 - *(const uint64_t *)arg2);
+	uint32_t i;
+
+	thread_block = &thread_blocks[buffer];
+	thread_stats = &thread_block->stats;
+	tx_s->count = 0;
+	/* Clear only the targets the thread sampled, there can be thousands */
+	for (i=0;i<target_used_count;i++)
+		bzero(&target_hists[target_used[i]], sizeof(struct lat_hist));
+	target_used_count = 0;
+	bzero(conn_stats, sizeof(struct connect_stats));
+	bzero(loop_s, sizeof(struct loop_stats));
 }
 
-static int sample_cmp_latency(const void *arg1, const void *arg2)
+int alloc_lat_samples(struct lat_samples *samples, uint32_t size)
 {
-	const struct lat_sample *lts1, *lts2;
-
-	lts1 = (const struct lat_sample *)arg1;
-	lts2 = (const struct lat_sample *)arg2;
+	samples->lat = malloc(size*sizeof(uint32_t));
+	samples->tx = malloc(size*sizeof(int64_t));
+	if (!samples->lat || !samples->tx) {
+		lancet_fprintf(stderr, "Failed to allocate latency samples\n");
+		return -1;
+	}
 
-	return lts1->nsec - lts2->nsec;
+	return 0;
 }
 
-static int sample_cmp_tx(const void *arg1, const void *arg2)
+static void alloc_sort_buffers(void)
 {
-	const struct lat_sample *lts1, *lts2;
-
-	lts1 = (const struct lat_sample *)arg1;
-	lts2 = (const struct lat_sample *)arg2;
+	if (sort_keys)
+		return;
+	sort_keys = malloc(AGG_SAMPLE_SIZE*sizeof(uint64_t));
+	sort_scratch = malloc(AGG_SAMPLE_SIZE*sizeof(uint64_t));
+	assert(sort_keys && sort_scratch);
+}
 
-	if (lts1->tx.tv_sec != lts2->tx.tv_sec)
-		return lts1->tx.tv_sec > lts2->tx.tv_sec;
+/*
+ * Don't subtract the values, the difference doesn't fit in an int
+ */
+static inline int u64_cmp(uint64_t a, uint64_t b)
+{
+	return (a > b) - (a < b);
+}
 
-	return lts1->tx.tv_nsec > lts2->tx.tv_nsec;
+static int long_compare(const void *arg1, const void *arg2)
+{
+	return u64_cmp(*(const uint64_t *)arg1, *(const uint64_t *)arg2);
 }
 
 /*
  * Smirnov-Kolmogorov statistic implementation
  */
-static double ks(uint64_t *a, uint64_t *b, int a_len, int b_len)
+static double ks_sorted(uint64_t *a, uint64_t *b, int a_len, int b_len)
 {
 	int ia, ib;
 	uint64_t min_val;
@@ -134,11 +261,6 @@ static double ks(uint64_t *a, uint64_t *b, int a_len, int b_len)
 
 	ia = 0;
 	ib = 0;
-
-	/* Sort the two arrays */
-	qsort(a, a_len, sizeof(uint64_t), long_compare);
-	qsort(b, b_len, sizeof(uint64_t), long_compare);
-
 	max_diff = 0;
 	while ((ia < a_len) && (ib < b_len)) {
 		min_val = a[ia] < b[ib] ? a[ia] : b[ib];
@@ -160,80 +282,90 @@ static double ks(uint64_t *a, uint64_t *b, int a_len, int b_len)
 	return max_diff;
 }
 
-static double ks_lts(struct lat_sample *a, struct lat_sample *b, int a_len, int b_len)
+static double ks(uint64_t *a, uint64_t *b, int a_len, int b_len)
 {
-	int ia, ib;
-	uint64_t min_val;
-	double diff, max_diff;
+	/* Sort the two arrays */
+	qsort(a, a_len, sizeof(uint64_t), long_compare);
+	qsort(b, b_len, sizeof(uint64_t), long_compare);
 
-	ia = 0;
-	ib = 0;
+	return ks_sorted(a, b, a_len, b_len);
+}
 
-	/* Sort the two arrays */
-	qsort(a, a_len, sizeof(struct lat_sample), sample_cmp_latency);
-	qsort(b, b_len, sizeof(struct lat_sample), sample_cmp_latency);
+static inline uint32_t encode_latency(long nsec)
+{
+	if (nsec < 0)
+		return 0;
+	if (nsec > UINT32_MAX)
+		return UINT32_MAX;
+	return nsec;
+}
 
-	max_diff = 0;
-	while ((ia < a_len) && (ib < b_len)) {
-		min_val = a[ia].nsec < b[ib].nsec ? a[ia].nsec : b[ib].nsec;
+static inline int64_t encode_tx_offset(struct timespec *tx)
+{
+	int64_t nsec;
 
-		if (min_val == a[ia].nsec) {
-			diff = ((ia+1)/((double)a_len)) - (ib/((double)b_len));
-			ia++;
-		}
-		if (min_val == b[ib].nsec) {
-			diff = (ib+1)/((double)b_len) - ia/((double)a_len);
-			ib++;
-		}
-		if (diff < 0)
-			diff *= (-1.0);
-		if (max_diff < diff) {
-			max_diff = diff;
-		}
+	nsec = tx->tv_sec * 1000000000L + tx->tv_nsec;
+	/* The first sample of the measurement defines the base */
+	if (!tx_base)
+		__sync_val_compare_and_swap(&tx_base, 0, nsec);
+	return nsec - tx_base;
+}
+
+/*
+ * Fill keys with the latencies ordered by tx time.
+ * The keys are the tx offset from the earliest sample above the sample
+ * index, the offset losing as many low bits as it takes to fit, so that
+ * a window of any length keeps its order down to the tie breaks.
+ */
+static void latencies_by_tx(struct latency_stats *lt_s, uint64_t *keys)
+{
+	uint32_t i, size = lt_s->size;
+	int64_t *tx = lt_s->samples.tx;
+	int64_t min = INT64_MAX, max = INT64_MIN;
+	int idx_bits, shift = 0;
+
+	if (!size)
+		return;
+	for (i=0;i<size;i++) {
+		if (tx[i] < min)
+			min = tx[i];
+		if (tx[i] > max)
+			max = tx[i];
 	}
-	return max_diff;
+	idx_bits = 64 - __builtin_clzll((uint64_t)size);
+	while (((uint64_t)(max - min) >> shift) >> (64 - idx_bits))
+		shift++;
+
+	for (i=0;i<size;i++)
+		keys[i] = ((uint64_t)(tx[i] - min) >> shift << idx_bits) | i;
+	radix_sort(keys, sort_scratch, size,
+			idle_sort_workers(get_thread_count()));
+	for (i=0;i<size;i++)
+		keys[i] = lt_s->samples.lat[keys[i] & ((1ULL << idx_bits) - 1)];
 }
 
-uint32_t compute_convergence(struct lat_sample *samples, int size)
+uint32_t compute_convergence(struct latency_stats *lt_s)
 {
 	double dnm, val, size_d;
-	// sort the samples based on tx timestamp
-	qsort(samples, size, sizeof(struct lat_sample), sample_cmp_tx);
-
-	dnm = ks_lts(samples, &samples[size/2], size/2, size/2);
-	size_d = size/2;
+	uint32_t half;
+	int workers;
+
+	alloc_sort_buffers();
+	latencies_by_tx(lt_s, sort_keys);
+
+	// compare the first half of the experiment against the second
+	half = lt_s->size/2;
+	workers = idle_sort_workers(get_thread_count());
+	radix_sort(sort_keys, sort_scratch, half, workers);
+	radix_sort(&sort_keys[half], sort_scratch, half, workers);
+	dnm = ks_sorted(sort_keys, &sort_keys[half], half, half);
+	size_d = half;
 	val = ca * sqrt((2*size_d)/(size_d*size_d));
 	//printf("Dnm = %lf, val = %lf, size = %d\n", dnm, val, size);
-	//assert(0);
-#ifdef DUMP_SAMPLES
-	FILE *fp;
-	fp = fopen("/tmp/kogias/lancet-samples", "w");
-	for (int i=0;i<size;i++)
-		fprintf(fp, "%ld\n", samples[i].nsec);
-	fclose(fp);
-#endif
 
 	return dnm < val;
 }
 
-void compute_latency_percentiles(struct latency_stats *lt_s)
-{
-	int idx;
-	/* sort samples */
-	assert(0);
-	qsort(lt_s->samples, lt_s->size, sizeof(struct lat_sample),
-			sample_cmp_latency);
-
-	idx = lt_s->size * 50 / 100;
-	lt_s->p50 = lt_s->samples[idx].nsec;
-	idx = lt_s->size * 90 / 100;
-	lt_s->p90 = lt_s->samples[idx].nsec;
-	idx = lt_s->size * 95 / 100;
-	lt_s->p95 = lt_s->samples[idx].nsec;
-	idx = lt_s->size * 99 / 100;
-	lt_s->p99 = lt_s->samples[idx].nsec;
-}
-
 struct ci_idx get_ci_bounds(int n, double p)
 {
 	struct ci_idx res;
@@ -242,79 +374,158 @@ struct ci_idx get_ci_bounds(int n, double p)
 	prod = n*p;
 	sq = heta * sqrt(prod*(1-p));
 
-	res.i = (uint32_t)floor(prod - sq);
+	res.i = (prod > sq) ? (uint32_t)floor(prod - sq) : 0;
 	res.k = (uint32_t)ceil(prod + sq) + 1;
 
 	return res;
 }
 
+/*
+ * Clamp the order statistic index for small sample counts
+ */
+static inline uint64_t order_stat(uint64_t *sorted, uint32_t size, long idx)
+{
+	if (idx < 0)
+		idx = 0;
+	if (idx >= size)
+		idx = size - 1;
+	return sorted[idx];
+}
+
+/*
+ * Exact percentiles: the latencies are copied out of the samples and
+ * radix sorted, using the cores that are not running agent threads.
+ */
 void compute_latency_percentiles_ci(struct latency_stats *lt_s)
 {
-	int idx, i;
+	uint32_t i, size;
 	uint64_t sum=0;
 	struct ci_idx bounds;
-	/* sort samples */
-	qsort(lt_s->samples, lt_s->size, sizeof(struct lat_sample),
-			sample_cmp_latency);
-	for (i=0;i<lt_s->size;i++)
-		sum += lt_s->samples[i].nsec;
-
-	assert(lt_s->size>0);
-	lt_s->avg_lat = sum / lt_s->size;
-
-	idx = lt_s->size * 50 / 100;
-	lt_s->p50 = lt_s->samples[idx].nsec;
-	bounds = get_ci_bounds(lt_s->size, 0.50);
-	lt_s->p50_i = lt_s->samples[bounds.i].nsec;
-	lt_s->p50_k = lt_s->samples[bounds.k].nsec;
-
-	idx = lt_s->size * 90 / 100;
-	lt_s->p90 = lt_s->samples[idx].nsec;
-	bounds = get_ci_bounds(lt_s->size, 0.90);
-	lt_s->p90_i = lt_s->samples[bounds.i].nsec;
-	lt_s->p90_k = lt_s->samples[bounds.k].nsec;
-
-	idx = lt_s->size * 95 / 100;
-	lt_s->p95 = lt_s->samples[idx].nsec;
-	bounds = get_ci_bounds(lt_s->size, 0.95);
-	lt_s->p95_i = lt_s->samples[bounds.i].nsec;
-	lt_s->p95_k = lt_s->samples[bounds.k].nsec;
-
-	idx = lt_s->size * 99 / 100;
-	lt_s->p99 = lt_s->samples[idx].nsec;
-	bounds = get_ci_bounds(lt_s->size, 0.99);
-	lt_s->p99_i = lt_s->samples[bounds.i].nsec;
-	lt_s->p99_k = lt_s->samples[bounds.k].nsec;
+
+	size = lt_s->size;
+	assert(size>0);
+	assert(size <= AGG_SAMPLE_SIZE);
+	alloc_sort_buffers();
+
+	for (i=0;i<size;i++) {
+		sort_keys[i] = lt_s->samples.lat[i];
+		sum += sort_keys[i];
+	}
+	lt_s->avg_lat = sum / size;
+
+	radix_sort(sort_keys, sort_scratch, size,
+			idle_sort_workers(get_thread_count()));
+
+	lt_s->p50 = order_stat(sort_keys, size, (long)size * 50 / 100);
+	bounds = get_ci_bounds(size, 0.50);
+	lt_s->p50_i = order_stat(sort_keys, size, bounds.i);
+	lt_s->p50_k = order_stat(sort_keys, size, bounds.k);
+
+	lt_s->p90 = order_stat(sort_keys, size, (long)size * 90 / 100);
+	bounds = get_ci_bounds(size, 0.90);
+	lt_s->p90_i = order_stat(sort_keys, size, bounds.i);
+	lt_s->p90_k = order_stat(sort_keys, size, bounds.k);
+
+	lt_s->p95 = order_stat(sort_keys, size, (long)size * 95 / 100);
+	bounds = get_ci_bounds(size, 0.95);
+	lt_s->p95_i = order_stat(sort_keys, size, bounds.i);
+	lt_s->p95_k = order_stat(sort_keys, size, bounds.k);
+
+	lt_s->p99 = order_stat(sort_keys, size, (long)size * 99 / 100);
+	bounds = get_ci_bounds(size, 0.99);
+	lt_s->p99_i = order_stat(sort_keys, size, bounds.i);
+	lt_s->p99_k = order_stat(sort_keys, size, bounds.k);
 }
 
-void aggregate_throughput_stats(union stats *agg_stats)
+static inline void stats_write_begin(void)
 {
-	int i;
+	__atomic_store_n(&thread_block->seq, thread_block->seq + 1,
+			__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-	clear_stats(agg_stats);
-	for (i=0;i<agent_count;i++) {
-		agg_stats->th_s.rx.bytes += all_stats[i]->th_s.rx.bytes;
-		agg_stats->th_s.tx.bytes += all_stats[i]->th_s.tx.bytes;
-		agg_stats->th_s.rx.reqs  += all_stats[i]->th_s.rx.reqs;;
-		agg_stats->th_s.tx.reqs  += all_stats[i]->th_s.tx.reqs;
-	}
+static inline void stats_write_end(void)
+{
+	__atomic_store_n(&thread_block->seq, thread_block->seq + 1,
+			__ATOMIC_RELEASE);
 }
 
-void aggregate_latency_samples(union stats *agg_stats)
+/*
+ * Torn-free copy of the counters of a thread, the latency stats start
+ * with the same counters
+ */
+static void snapshot_throughput(struct stats_block *block,
+		struct throughput_stats *res)
 {
-	int i, agg_count=0;
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&block->seq, __ATOMIC_ACQUIRE);
+		*res = block->stats.th_s;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+			(seq != __atomic_load_n(&block->seq, __ATOMIC_RELAXED)));
+}
 
+static void sum_throughput(struct throughput_stats *agg,
+		struct throughput_stats *th_s)
+{
+	agg->rx.bytes += th_s->rx.bytes;
+	agg->tx.bytes += th_s->tx.bytes;
+	agg->rx.reqs += th_s->rx.reqs;
+	agg->tx.reqs += th_s->tx.reqs;
+	agg->reconnects += th_s->reconnects;
+	agg->failed_sends += th_s->failed_sends;
+}
+
+/*
+ * The threads of a node first, then the per-node sums
+ */
+static void aggregate_nodes(struct throughput_stats *agg)
+{
+	struct throughput_stats snap;
+	struct thread_entry *e;
+	int n, i;
+
+	for (n=0;n<node_count;n++) {
+		bzero(&node_th[n], sizeof(struct throughput_stats));
+		for (i=node_start[n];i<node_start[n+1];i++) {
+			if (!(e = registered(node_threads[i])))
+				continue;
+			snapshot_throughput(&e->blocks[active_buffer], &snap);
+			sum_throughput(&node_th[n], &snap);
+		}
+		sum_throughput(agg, &node_th[n]);
+	}
+}
+
+void aggregate_throughput_stats(union stats *agg_stats)
+{
 	clear_stats(agg_stats);
-	bzero(agg_stats->lt_s.samples, AGG_SAMPLE_SIZE*sizeof(struct lat_sample));
+	aggregate_nodes(&agg_stats->th_s);
+}
 
-	for (i=0;i<agent_count;i++) {
-		agg_stats->lt_s.th_s.rx.bytes += all_stats[i]->lt_s.th_s.rx.bytes;
-		agg_stats->lt_s.th_s.tx.bytes += all_stats[i]->lt_s.th_s.tx.bytes;
-		agg_stats->lt_s.th_s.rx.reqs  += all_stats[i]->lt_s.th_s.rx.reqs;;
-		agg_stats->lt_s.th_s.tx.reqs  += all_stats[i]->lt_s.th_s.tx.reqs;
+void aggregate_latency_samples(union stats *agg_stats)
+{
+	int i;
+	uint32_t agg_count=0, to_copy;
+	struct lat_samples *dst, *src;
+	struct thread_entry *e;
 
-		memcpy(&agg_stats->lt_s.samples[agg_count], all_stats[i]->lt_s.samples, (all_stats[i]->lt_s.size)*sizeof(struct lat_sample));
-		agg_count += all_stats[i]->lt_s.size;
+	clear_stats(agg_stats);
+	aggregate_nodes(&agg_stats->lt_s.th_s);
+	dst = &agg_stats->lt_s.samples;
+
+	for (i=0;i<thread_count;i++) {
+		if (!(e = registered(node_threads[i])))
+			continue;
+		src = &e->blocks[active_buffer].stats.lt_s.samples;
+		to_copy = e->blocks[active_buffer].stats.lt_s.size;
+		if (agg_count + to_copy > AGG_SAMPLE_SIZE)
+			to_copy = AGG_SAMPLE_SIZE - agg_count;
+		memcpy(&dst->lat[agg_count], src->lat, to_copy*sizeof(uint32_t));
+		memcpy(&dst->tx[agg_count], src->tx, to_copy*sizeof(int64_t));
+		agg_count += to_copy;
 	}
 	agg_stats->lt_s.size = agg_count;
 }
@@ -340,19 +551,25 @@ void collect_reference_ia(struct rand_gen *gen)
 
 int check_ia(void)
 {
-	int i, copy_idx = 0, to_copy, ret;
-	struct timespec data[MAX_THREADS*MAX_PER_THREAD_TX_SAMPLES];
-	static uint64_t collected_ia[MAX_THREADS*MAX_PER_THREAD_TX_SAMPLES];
+	int i, copy_idx = 0, to_copy, ret, pass;
+	struct timespec *data;
+	uint64_t *collected_ia;
 	struct timespec diff;
 	double ks_result, val, collected_ia_size;
+	struct thread_entry *e;
+
+	data = malloc(thread_count*MAX_PER_THREAD_TX_SAMPLES*sizeof(struct timespec));
+	collected_ia = malloc(thread_count*MAX_PER_THREAD_TX_SAMPLES*sizeof(uint64_t));
+	assert(data && collected_ia);
 
 	// Collect all tx
-	for (i=0;i<agent_count;i++) {
-		to_copy = (all_tx[i]->count > MAX_PER_THREAD_TX_SAMPLES ? MAX_PER_THREAD_TX_SAMPLES : all_tx[i]->count);
-		memcpy(&data[copy_idx], all_tx[i]->samples, to_copy*sizeof(struct timespec));
+	for (i=0;i<thread_count;i++) {
+		if (!(e = registered(i)))
+			continue;
+		to_copy = (e->tx->count > MAX_PER_THREAD_TX_SAMPLES ? MAX_PER_THREAD_TX_SAMPLES : e->tx->count);
+		memcpy(&data[copy_idx], e->tx->samples, to_copy*sizeof(struct timespec));
 		copy_idx += to_copy;
 	}
-	assert(copy_idx <= MAX_THREADS*MAX_PER_THREAD_TX_SAMPLES);
 	// Sort
 	qsort(data, copy_idx, sizeof(struct timespec), timespec_cmp);
 
@@ -376,8 +593,11 @@ int check_ia(void)
 	ks_result = ks(reference_ia, collected_ia, REFERENCE_IA_SIZE, copy_idx-1);
 	collected_ia_size = copy_idx - 1;
 	val = ca * sqrt((REFERENCE_IA_SIZE+collected_ia_size)/(REFERENCE_IA_SIZE*collected_ia_size));
-	lancet_fprintf(stderr, "IA KS = %lf, val = %lf, pass = %d\n", ks_result, val, ks_result < val);
-	return ks_result < val;
+	pass = ks_result < val;
+	lancet_fprintf(stderr, "IA KS = %lf, val = %lf, pass = %d\n", ks_result, val, pass);
+	free(data);
+	free(collected_ia);
+	return pass;
 #if 0
 	for (i=1;i<REFERENCE_IA_SIZE;i++)
 		lancet_fprintf(stderr, "reference: %ld\n", reference_ia[i]);
@@ -389,97 +609,374 @@ int check_ia(void)
 
 double check_iid(struct latency_stats *lt_s)
 {
-	uint64_t sum, sum_of_squares;
-	int i;
+	double sum, sum_of_squares, first, last;
+	uint32_t i, n;
 	double avg_x, avg_y, sx, sy, avg_sqr_x, avg_sqr_y, cov_sum, cov, p_corr;
 
-	// Sort based on timestamp
-	qsort(lt_s->samples, lt_s->size, sizeof(struct lat_sample), sample_cmp_tx);
+	// Order based on timestamp
+	alloc_sort_buffers();
+	latencies_by_tx(lt_s, sort_keys);
+	n = lt_s->size;
+	first = sort_keys[0];
+	last = sort_keys[n-1];
 
 	sum = 0;
 	sum_of_squares = 0;
-	for (i=1;i<lt_s->size-1;i++) {
-		sum += lt_s->samples[i].nsec;
-		sum_of_squares += (lt_s->samples[i].nsec * lt_s->samples[i].nsec);
+	for (i=1;i<n-1;i++) {
+		sum += sort_keys[i];
+		sum_of_squares += (double)sort_keys[i] * sort_keys[i];
 	}
-	avg_x = (sum + lt_s->samples[0].nsec) / (double) (lt_s->size-1);
-	avg_y = (sum + lt_s->samples[lt_s->size-1].nsec) / (double) (lt_s->size-1);
-	avg_sqr_x = (sum_of_squares + lt_s->samples[0].nsec*lt_s->samples[0].nsec)
-		/ (double) (lt_s->size-1);
-	avg_sqr_y = (sum_of_squares + lt_s->samples[lt_s->size-1].nsec
-			*lt_s->samples[lt_s->size-1].nsec) / (double) (lt_s->size - 1);
+	avg_x = (sum + first) / (double) (n-1);
+	avg_y = (sum + last) / (double) (n-1);
+	avg_sqr_x = (sum_of_squares + first*first) / (double) (n-1);
+	avg_sqr_y = (sum_of_squares + last*last) / (double) (n-1);
 
 	sx = sqrt(avg_sqr_x - avg_x*avg_x);
 	sy = sqrt(avg_sqr_y - avg_y*avg_y);
 
 	// Compute the covariance
 	cov_sum = 0;
-	for (i=0;i<lt_s->size-1;i++)
-		cov_sum += ((lt_s->samples[i].nsec - avg_x) * (lt_s->samples[i+1].nsec - avg_y));
+	for (i=0;i<n-1;i++)
+		cov_sum += ((sort_keys[i] - avg_x) * (sort_keys[i+1] - avg_y));
 
-	cov = cov_sum / (lt_s->size-1);
+	cov = cov_sum / (n-1);
 	p_corr = cov / (sx*sy);
 	lancet_fprintf(stderr, "Pearson correlation = %lf\n", p_corr);
 
 	return p_corr;
 }
 
-int init_per_thread_stats(void)
+/*
+ * Merge the per-thread histograms of every target. Only the targets with
+ * samples are returned. Jain's fairness index is computed over the
+ * per-target p99 and the per-target completed requests.
+ */
+int compute_target_stats(struct target_latency *res,
+		struct target_fairness *fairness)
+{
+	struct lat_hist hist;
+	struct thread_entry *e;
+	int i, t, count = 0;
+	double sum_p99 = 0, sq_p99 = 0, sum_tp = 0, sq_tp = 0;
+
+	bzero(fairness, sizeof(struct target_fairness));
+	fairness->min_p99 = UINT64_MAX;
+	for (t=0;t<get_target_count();t++) {
+		bzero(&hist, sizeof(struct lat_hist));
+		for (i=0;i<thread_count;i++)
+			if ((e = registered(i)) && e->target_hists[t].count)
+				hist_merge(&hist, &e->target_hists[t]);
+		if (!hist.count)
+			continue;
+
+		res[count].target = t;
+		res[count].count = hist.count;
+		res[count].avg_lat = hist.sum / hist.count;
+		res[count].p50 = hist_percentile(&hist, 0.50);
+		res[count].p90 = hist_percentile(&hist, 0.90);
+		res[count].p99 = hist_percentile(&hist, 0.99);
+
+		if (res[count].p99 > fairness->max_p99)
+			fairness->max_p99 = res[count].p99;
+		if (res[count].p99 < fairness->min_p99)
+			fairness->min_p99 = res[count].p99;
+		sum_p99 += res[count].p99;
+		sq_p99 += (double)res[count].p99 * res[count].p99;
+		sum_tp += hist.count;
+		sq_tp += (double)hist.count * hist.count;
+		count++;
+	}
+
+	if (!count) {
+		fairness->min_p99 = 0;
+		return 0;
+	}
+	fairness->jain_p99 = sq_p99 > 0 ? (sum_p99 * sum_p99) / (count * sq_p99) : 1;
+	fairness->jain_throughput = (sum_tp * sum_tp) / (count * sq_tp);
+
+	return count;
+}
+
+int add_connect_sample(long diff)
+{
+	if (!should_measure())
+		return 0;
+	hist_add(&conn_stats->hist, encode_latency(diff));
+	return 0;
+}
+
+void add_connect_error(void)
+{
+	if (should_measure())
+		conn_stats->connect_errors++;
+}
+
+void add_request_error(void)
+{
+	if (should_measure())
+		conn_stats->request_errors++;
+}
+
+void aggregate_connect_stats(struct connect_stats *agg)
+{
+	struct thread_entry *e;
+	int i;
+
+	bzero(agg, sizeof(struct connect_stats));
+	for (i=0;i<thread_count;i++) {
+		if (!(e = registered(i)))
+			continue;
+		hist_merge(&agg->hist, &e->conn_stats->hist);
+		agg->connect_errors += e->conn_stats->connect_errors;
+		agg->request_errors += e->conn_stats->request_errors;
+	}
+}
+
+/*
+ * NULL if the thread didn't register yet
+ */
+struct loop_stats *get_loop_stats(int thread)
+{
+	struct thread_entry *e;
+
+	e = registered(thread);
+	return e ? e->loop_stats : NULL;
+}
+
+/*
+ * The requests, the responses and the latency histogram of every thread
+ * since the previous call. The totals are read while the threads update
+ * them, so the count is recomputed from the buckets that were read.
+ */
+void aggregate_interval_stats(struct interval_stats *agg)
+{
+	struct interval_stats cur, *prev;
+	struct thread_entry *e;
+	int i, b;
+
+	bzero(agg, sizeof(struct interval_stats));
+	for (i=0;i<thread_count;i++) {
+		if (!(e = registered(i)))
+			continue;
+		prev = &interval_prev[i];
+		cur.sent = __atomic_load_n(&e->interval->sent, __ATOMIC_RELAXED);
+		cur.reqs = __atomic_load_n(&e->interval->reqs, __ATOMIC_RELAXED);
+		memcpy(&cur.lat, &e->interval->lat, sizeof(struct lat_hist));
+		agg->sent += cur.sent - prev->sent;
+		agg->reqs += cur.reqs - prev->reqs;
+		agg->lat.sum += cur.lat.sum - prev->lat.sum;
+		for (b=0;b<HIST_BUCKETS;b++) {
+			agg->lat.buckets[b] += cur.lat.buckets[b] - prev->lat.buckets[b];
+			agg->lat.count += cur.lat.buckets[b] - prev->lat.buckets[b];
+		}
+		*prev = cur;
+	}
+}
+
+/*
+ * Reset, enable or disable the hardware counters of every thread
+ */
+void control_perf_counters(unsigned long op)
+{
+	struct thread_entry *e;
+	int i;
+
+	for (i=0;i<thread_count;i++)
+		if ((e = registered(i)) && e->perf)
+			perf_counters_ctl(e->perf, op);
+}
+
+/*
+ * The counters of a thread and the responses it received in the
+ * measurement, returns the mask of the available counters
+ */
+uint32_t read_perf_counters(int thread, uint64_t *values, uint64_t *requests)
 {
-	int thread_id;
+	struct throughput_stats snap;
+	struct thread_entry *e;
+
+	*requests = 0;
+	bzero(values, PERF_COUNTER_NR * sizeof(uint64_t));
+	if (!(e = registered(thread)) || !e->perf)
+		return 0;
+	snapshot_throughput(&e->blocks[active_buffer], &snap);
+	*requests = snap.rx.reqs;
+	perf_counters_read(e->perf, values);
+	return perf_counters_available(e->perf);
+}
 
-	thread_stats = malloc(sizeof(union stats) +
-			MAX_PER_THREAD_SAMPLES*sizeof(struct lat_sample));
-	thread_id = __sync_fetch_and_add(&agent_count, 1);
-	assert(thread_id < 64);
-	all_stats[thread_id] = thread_stats;
-	tx_s.count = 0;
-	all_tx[thread_id] = &tx_s;
+/*
+ * Every thread spreads its connections round-robin over the targets
+ */
+int init_readiness(void)
+{
+	int i, t;
+
+	readiness = calloc(get_target_count(), sizeof(struct target_readiness));
+	if (!readiness) {
+		lancet_fprintf(stderr, "Failed to allocate readiness map\n");
+		return -1;
+	}
+	for (t=0;t<get_thread_count();t++)
+		for (i=0;i<get_thread_conn_count(t);i++)
+			readiness[i % get_target_count()].conns++;
+	readiness_start = time_ns();
+
+	return 0;
+}
+
+void add_connect_retry(uint32_t target)
+{
+	__sync_fetch_and_add(&readiness[target].retries, 1);
+}
+
+void add_target_ready(uint32_t target)
+{
+	struct target_readiness *r = &readiness[target];
+	uint64_t now;
+
+	now = time_ns() - readiness_start;
+	__sync_bool_compare_and_swap(&r->first_ready, 0, now);
+	if (__sync_add_and_fetch(&r->ready, 1) == r->conns)
+		r->all_ready = now;
+}
+
+void remove_target_ready(uint32_t target)
+{
+	__sync_fetch_and_sub(&readiness[target].ready, 1);
+	readiness[target].all_ready = 0;
+}
+
+struct target_readiness *get_readiness(long *elapsed)
+{
+	*elapsed = time_ns() - readiness_start;
+	return readiness;
+}
+
+int init_per_thread_stats(void)
+{
+	struct thread_entry *e;
+
+	thread_blocks = aligned_alloc(64, 2 * sizeof(struct stats_block));
+	assert(thread_blocks);
+	bzero(thread_blocks, 2 * sizeof(struct stats_block));
+	thread_block = &thread_blocks[0];
+	thread_stats = &thread_block->stats;
+	tx_s = aligned_alloc(64, (sizeof(struct tx_samples) + 63) & ~63UL);
+	assert(tx_s);
+	/* Only the active block is reported, so the samples are shared */
+	if (alloc_lat_samples(&thread_stats->lt_s.samples, MAX_PER_THREAD_SAMPLES))
+		return -1;
+	thread_blocks[1].stats.lt_s.samples = thread_stats->lt_s.samples;
+	tx_s->count = 0;
+	target_hists = calloc(get_target_count(), sizeof(struct lat_hist));
+	assert(target_hists);
+	target_used = malloc(get_target_count() * sizeof(uint32_t));
+	assert(target_used);
+	target_used_count = 0;
+	conn_stats = calloc(1, sizeof(struct connect_stats));
+	assert(conn_stats);
+	loop_s = calloc(1, sizeof(struct loop_stats));
+	assert(loop_s);
+	interval_s = calloc(1, sizeof(struct interval_stats));
+	assert(interval_s);
 	per_thread_lat_count = 0;
 
+	e = &threads[get_agent_tid()];
+	e->tx = tx_s;
+	e->target_hists = target_hists;
+	e->conn_stats = conn_stats;
+	e->loop_stats = loop_s;
+	e->interval = interval_s;
+	if (get_perf_counters()) {
+		e->perf = malloc(sizeof(struct perf_counters));
+		assert(e->perf);
+		perf_counters_open(e->perf);
+	}
+	__atomic_store_n(&e->blocks, thread_blocks, __ATOMIC_RELEASE);
+
 	return 0;
 }
 
 int add_throughput_tx_sample(struct byte_req_pair tx_p)
 {
+	__atomic_store_n(&interval_s->sent, interval_s->sent + tx_p.reqs,
+			__ATOMIC_RELAXED);
 	if (!should_measure())
 		return 0;
 
+	stats_write_begin();
 	thread_stats->th_s.tx.bytes += tx_p.bytes;
 	thread_stats->th_s.tx.reqs += tx_p.reqs;
+	stats_write_end();
 
 	return 0;
 }
 
 int add_throughput_rx_sample(struct byte_req_pair rx_p)
 {
+	__atomic_store_n(&interval_s->reqs, interval_s->reqs + rx_p.reqs,
+			__ATOMIC_RELAXED);
 	if (!should_measure())
 		return 0;
 
+	stats_write_begin();
 	thread_stats->th_s.rx.bytes += rx_p.bytes;
 	thread_stats->th_s.rx.reqs += rx_p.reqs;
+	stats_write_end();
 	return 0;
 }
 
+void add_reconnect(void)
+{
+	if (!should_measure())
+		return;
+	stats_write_begin();
+	thread_stats->th_s.reconnects++;
+	stats_write_end();
+}
+
+void add_failed_send(void)
+{
+	if (!should_measure())
+		return;
+	stats_write_begin();
+	thread_stats->th_s.failed_sends++;
+	stats_write_end();
+}
+
 int add_tx_timestamp(struct timespec *tx_ts)
 {
 	if (!should_measure())
 		return 0;
-	tx_s.samples[tx_s.count++ % MAX_PER_THREAD_TX_SAMPLES] = *tx_ts;
+	tx_s->samples[tx_s->count++ % MAX_PER_THREAD_TX_SAMPLES] = *tx_ts;
 
 	return 0;
 }
 
-int add_latency_sample(long diff, struct timespec *tx)
+static inline void add_target_sample(uint32_t target, uint32_t lat)
+{
+	if (!target_hists[target].count)
+		target_used[target_used_count++] = target;
+	hist_add(&target_hists[target], lat);
+}
+
+int add_latency_sample(long diff, struct timespec *tx, uint32_t conn,
+		uint32_t target)
 {
-	struct lat_sample *lts;
+	uint32_t idx;
 
-	if (!should_measure() || (drand48()>sampling_rate))
+	hist_add(&interval_s->lat, encode_latency(diff));
+	if (!should_measure())
+		return 0;
+	// The dump and the per-target stats get every sample
+	dump_sample(tx, encode_latency(diff), conn, target);
+	add_target_sample(target, encode_latency(diff));
+	if (drand48()>sampling_rate)
 		return 0;
-	lts = &thread_stats->lt_s.samples[thread_stats->lt_s.count++ % per_thread_samples];
-	lts->nsec = diff;
-	if (tx)
-		lts->tx = *tx;
+	idx = thread_stats->lt_s.count++ % per_thread_samples;
+	thread_stats->lt_s.samples.lat[idx] = encode_latency(diff);
+	thread_stats->lt_s.samples.tx[idx] = tx ? encode_tx_offset(tx) : 0;
 	thread_stats->lt_s.size = thread_stats->lt_s.count > per_thread_samples ? per_thread_samples : thread_stats->lt_s.count;
 
 	return 0;
@@ -0,0 +1,208 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lancet/error.h>
+#include <lancet/tenant.h>
+
+/*
+ * <first>[-<last>]/<rate>[/<app proto>[/<idist>[/<load schedule>]]]
+ * with the target indices in the order of -s, - keeps the agent's
+ * protocol or distribution
+ */
+int parse_tenant(char *spec, struct tenant *t)
+{
+	char *tok, *end;
+
+	memset(t, 0, sizeof(struct tenant));
+	tok = strtok_r(spec, "/", &spec);
+	if (!tok)
+		goto usage;
+	t->first_target = strtol(tok, &end, 10);
+	t->last_target = (*end == '-') ? atoi(end + 1) : t->first_target;
+	tok = strtok_r(spec, "/", &spec);
+	if (!tok)
+		goto usage;
+	t->rate = atof(tok);
+	if (t->rate <= 0) {
+		lancet_fprintf(stderr, "Tenant rates must be positive\n");
+		return -1;
+	}
+	tok = strtok_r(spec, "/", &spec);
+	if (tok && strcmp(tok, "-")) {
+		t->app_proto = init_app_proto(tok);
+		if (!t->app_proto) {
+			lancet_fprintf(stderr, "Failed to create app proto\n");
+			return -1;
+		}
+	}
+	tok = strtok_r(spec, "/", &spec);
+	if (tok && strcmp(tok, "-")) {
+		t->idist = init_rand(tok);
+		if (!t->idist) {
+			lancet_fprintf(stderr, "Failed to create iadist\n");
+			return -1;
+		}
+	}
+	tok = strtok_r(spec, "/", &spec);
+	if (tok) {
+		t->load_sched = init_load_sched(tok);
+		if (!t->load_sched)
+			return -1;
+	}
+	return 0;
+usage:
+	lancet_fprintf(stderr, "Tenants are <targets>/<rate>[/<proto>[/<idist>[/<schedule>]]]\n");
+	return -1;
+}
+
+/*
+ * Every target belongs to one tenant. The tenants without their own
+ * protocol, distribution or schedule get the agent's, a copy of the
+ * latter two.
+ */
+int init_tenants(struct tenant *tenants, int count, int target_count,
+		struct application_protocol *app_proto, char *idist_spec,
+		char *sched_spec)
+{
+	struct tenant *t;
+	int i, j, owner;
+
+	for (i=0;i<target_count;i++) {
+		owner = -1;
+		for (j=0;j<count;j++) {
+			t = &tenants[j];
+			if ((i < t->first_target) || (i > t->last_target))
+				continue;
+			if (owner >= 0) {
+				lancet_fprintf(stderr, "Target %d is in tenants %d and %d\n",
+						i, owner, j);
+				return -1;
+			}
+			owner = j;
+		}
+		if (owner < 0) {
+			lancet_fprintf(stderr, "Target %d is in no tenant\n", i);
+			return -1;
+		}
+	}
+	for (i=0;i<count;i++) {
+		t = &tenants[i];
+		if ((t->first_target > t->last_target) ||
+				(t->last_target >= target_count)) {
+			lancet_fprintf(stderr, "Tenant %d has no targets\n", i);
+			return -1;
+		}
+		if (!t->app_proto)
+			t->app_proto = app_proto;
+		if (!t->idist) {
+			if (!idist_spec) {
+				lancet_fprintf(stderr, "Tenant %d has no distribution\n", i);
+				return -1;
+			}
+			t->idist = init_rand(strdup(idist_spec));
+			if (!t->idist)
+				return -1;
+		}
+		if (!t->load_sched && sched_spec) {
+			t->load_sched = init_load_sched(strdup(sched_spec));
+			if (!t->load_sched)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+int find_tenant(struct tenant *tenants, int count, int target)
+{
+	int i;
+
+	for (i=0;i<count;i++)
+		if ((target >= tenants[i].first_target) &&
+				(target <= tenants[i].last_target))
+			return i;
+	return -1;
+}
+
+static double rate_sum(struct tenant *tenants, int count)
+{
+	double sum = 0;
+	int i;
+
+	for (i=0;i<count;i++)
+		sum += tenants[i].rate;
+	return sum;
+}
+
+/*
+ * The tenants split the load by their rates, every thread runs its
+ * share of each
+ */
+void tenants_set_load(struct tenant *tenants, int count, uint32_t load,
+		int thread_count)
+{
+	double per_thread_load, sum = rate_sum(tenants, count);
+	struct tenant *t;
+	int i;
+
+	per_thread_load = load / (double)thread_count;
+	for (i=0;i<count;i++) {
+		t = &tenants[i];
+		set_avg(t->idist, 1e6 * sum / (per_thread_load * t->rate));
+		if (t->load_sched)
+			load_sched_start(t->load_sched, lround(load * t->rate / sum));
+	}
+}
+
+/*
+ * The mean rate offered over [from, to], time_ns() values, for a
+ * START_LOAD of load
+ */
+double tenants_offered_rate(struct tenant *tenants, int count,
+		uint32_t load, long from, long to)
+{
+	double rate = 0, sum = rate_sum(tenants, count);
+	struct tenant *t;
+	int i;
+
+	for (i=0;i<count;i++) {
+		t = &tenants[i];
+		rate += t->load_sched ? load_sched_rate(t->load_sched, from, to) :
+			load * t->rate / sum;
+	}
+	return rate;
+}
+
+/* Send time of the tenant's request after the one at next_tx */
+long tenant_next_tx(struct tenant *t, long next_tx)
+{
+	long ia = lround(generate(t->idist) * 1000);
+
+	if (t->load_sched)
+		return load_sched_next(t->load_sched, next_tx, ia);
+	return next_tx + ia;
+}
@@ -22,6 +22,7 @@
 //THE SOFTWARE.
 
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -48,6 +49,7 @@
 #include <lancet/timestamping.h>
 
 #define CONTROL_LEN 1024
+#define TX_TS_BATCH 32
 
 static __thread int received_opid;
 
@@ -79,15 +81,18 @@ static int extract_timestamps(struct msghdr * hdr, struct timestamp_info *dest)
 {
 	struct cmsghdr *cmsg;
 	struct scm_timestamping *ts;
+	struct timespec *stamp;
 	int found = -1;
 
 	for(cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)){
 		if(cmsg->cmsg_type == SCM_TIMESTAMPING){
 			ts = (struct scm_timestamping *)CMSG_DATA(cmsg);
-			if(ts->ts[2].tv_sec != 0){
+			// ts[2] is the hardware timestamp, ts[0] the software one
+			stamp = ts->ts[2].tv_sec ? &ts->ts[2] : &ts->ts[0];
+			if(stamp->tv_sec != 0){
 				//make sure we don't get multiple timestamps for the same
 				assert(found == -1);
-				dest->time = ts->ts[2];
+				dest->time = *stamp;
 				found = 1;
 			}
 		} else if(cmsg->cmsg_type == IP_RECVERR) {
@@ -132,11 +137,18 @@ int disable_nic_timestamping(char * if_name)
 	return ret;
 }
 
-int sock_enable_timestamping(int fd)
+/*
+ * Hardware timestamps come from the NIC, software ones from the driver
+ * handoff, e.g. on loopback or veth
+ */
+int sock_enable_timestamping(int fd, int hardware)
 {
 	int ts_mode = 0;
 
-	ts_mode |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE;
+	if (hardware)
+		ts_mode |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE;
+	else
+		ts_mode |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE;
 	ts_mode |= SOF_TIMESTAMPING_OPT_TSONLY | SOF_TIMESTAMPING_OPT_ID;
 
 	if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING , &ts_mode, sizeof(ts_mode)) < 0){
@@ -171,61 +183,77 @@ ssize_t timestamp_recv(int sockfd, void *buf, size_t len, int flags,
 }
 
 /*
- * Used only for NIC timestamping
+ * Match one error queue message with the pending requests
  * 1 if timestamp found
  * 0 if timestamp not found
  */
-int get_tx_timestamp(int sockfd, struct pending_tx_timestamps *tx_timestamps)
+static int consume_tx_timestamp(struct msghdr *mhdr,
+		struct pending_tx_timestamps *tx_timestamps)
 {
-	char tx_control[CONTROL_LEN] = {0};
-	struct msghdr mhdr = {0};
-	struct iovec junk_iov = {NULL, 0};
 	int n;
 	struct timestamp_info *ts_info, *curr;
 
-	mhdr.msg_iov = &junk_iov;
-	mhdr.msg_iovlen = 1;
-	mhdr.msg_control = tx_control;
-	mhdr.msg_controllen = CONTROL_LEN;
-
-	n = recvmsg(sockfd, &mhdr, MSG_ERRQUEUE);
-	if (n<0)
-		return 0;
-
-	assert(n==0);
-
 	// Many requests might have the same timestamp because they got coalesced
-	ts_info = &tx_timestamps->pending[tx_timestamps->tail % MAX_PENDING_REQS];
-	n = extract_timestamps(&mhdr, ts_info);
-	if (n == -1) {
-		n = 0;
-		goto OUT;
-	}
+	ts_info = &tx_timestamps->pending[tx_timestamps->tail & tx_timestamps->mask];
+	n = extract_timestamps(mhdr, ts_info);
+	if (n == -1)
+		return 0;
 	add_tx_timestamp(&ts_info->time);
 	tx_timestamps->tail++;
-	if (n == 1) {
-		goto OUT;
-	}
+	if (n == 1)
+		return 1;
 	curr = ts_info;
-	ts_info = &tx_timestamps->pending[tx_timestamps->tail % MAX_PENDING_REQS];
+	ts_info = &tx_timestamps->pending[tx_timestamps->tail & tx_timestamps->mask];
 	while ((ts_info->optid <= received_opid+1) &&
 		(tx_timestamps->tail < tx_timestamps->head)) {
-		//lancet_fprintf(stderr, "loop1\n");
 		ts_info->time = curr->time;
 		add_tx_timestamp(&ts_info->time);
-		ts_info = &tx_timestamps->pending[++tx_timestamps->tail % MAX_PENDING_REQS];
+		ts_info = &tx_timestamps->pending[++tx_timestamps->tail & tx_timestamps->mask];
+	}
+	return 1;
+}
+
+/*
+ * Used only for kernel timestamping. Drains up to TX_TS_BATCH error
+ * queue messages with one syscall. The control buffers are reused, the
+ * kernel sets the length of what it wrote.
+ * 1 if timestamp found
+ * 0 if timestamp not found
+ */
+int get_tx_timestamp(int sockfd, struct pending_tx_timestamps *tx_timestamps)
+{
+	static __thread char tx_control[TX_TS_BATCH][CONTROL_LEN];
+	struct mmsghdr msgs[TX_TS_BATCH];
+	struct iovec junk_iov = {NULL, 0};
+	int i, n, found = 0;
+
+	for (i = 0; i < TX_TS_BATCH; i++) {
+		msgs[i].msg_hdr.msg_name = NULL;
+		msgs[i].msg_hdr.msg_namelen = 0;
+		msgs[i].msg_hdr.msg_iov = &junk_iov;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = tx_control[i];
+		msgs[i].msg_hdr.msg_controllen = CONTROL_LEN;
+		msgs[i].msg_hdr.msg_flags = 0;
+	}
+
+	n = recvmmsg(sockfd, msgs, TX_TS_BATCH, MSG_ERRQUEUE | MSG_DONTWAIT,
+			NULL);
+	if (n < 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		assert(msgs[i].msg_len == 0);
+		found |= consume_tx_timestamp(&msgs[i].msg_hdr, tx_timestamps);
 	}
-	n = 1;
-OUT:
-	//lancet_fprintf(stderr, "tid:%d\tget_tx_timestamp = %d\n", get_agent_tid(), n);
-	return n;
+	return found;
 }
 
 void add_pending_tx_timestamp(struct pending_tx_timestamps *tx_timestamps,
 		uint32_t bytes)
 {
 	tx_timestamps->tx_byte_counter += bytes;
-	tx_timestamps->pending[tx_timestamps->head++ % MAX_PENDING_REQS].optid = tx_timestamps->tx_byte_counter;
+	tx_timestamps->pending[tx_timestamps->head++ & tx_timestamps->mask].optid = tx_timestamps->tx_byte_counter;
 }
 
 struct timestamp_info *pop_pending_tx_timestamps(struct pending_tx_timestamps
@@ -234,7 +262,7 @@ struct timestamp_info *pop_pending_tx_timestamps(struct pending_tx_timestamps
 	struct timestamp_info *ret;
 	assert(tx_timestamps->consumed <= tx_timestamps->head);
 	if (tx_timestamps->consumed < tx_timestamps->tail)
-		ret = &tx_timestamps->pending[tx_timestamps->consumed++ % MAX_PENDING_REQS];
+		ret = &tx_timestamps->pending[tx_timestamps->consumed++ & tx_timestamps->mask];
 	else {
 		//lancet_fprintf(stderr, "tid:%d\tHaven't received tx timestamp yet\n", get_agent_tid());
 		//tx_timestamps->consumed++;
@@ -248,7 +276,7 @@ void push_complete_tx_timestamp(struct pending_tx_timestamps *tx_timestamps,
 {
 	struct timestamp_info *ts_info;
 
-	ts_info = &tx_timestamps->pending[tx_timestamps->tail % MAX_PENDING_REQS];
+	ts_info = &tx_timestamps->pending[tx_timestamps->tail & tx_timestamps->mask];
 	ts_info->time = *to_add;
 	// this is confusing but the consumed is used when receiving the reply
 	tx_timestamps->head++;
@@ -0,0 +1,284 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lancet/error.h>
+#include <lancet/topology.h>
+
+static int cpus[CPU_SETSIZE];
+static int cpu_count;
+static int cpu_node[CPU_SETSIZE];
+static int node_count = 1;
+static int reserved[CPU_SETSIZE];
+static int reserved_count;
+
+static int read_sysfs(char *path, char *buf, int len)
+{
+	FILE *f;
+	char *nl;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (!fgets(buf, len, f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	nl = strchr(buf, '\n');
+	if (nl)
+		*nl = '\0';
+	return 0;
+}
+
+/*
+ * Parse a kernel cpulist, e.g. 0-3,8,10-11, keeping the given order.
+ * Returns the number of CPUs.
+ */
+static int parse_cpulist(char *list, int *res, int max)
+{
+	char *token, *save, *dash;
+	int first, last, count = 0;
+
+	for (token = strtok_r(list, ",", &save); token;
+			token = strtok_r(NULL, ",", &save)) {
+		first = atoi(token);
+		dash = strchr(token, '-');
+		last = dash ? atoi(dash + 1) : first;
+		for (; (first <= last) && (count < max); first++)
+			res[count++] = first;
+	}
+	return count;
+}
+
+static int read_cpulist(char *path, int *res, int max)
+{
+	char buf[4096];
+
+	if (read_sysfs(path, buf, sizeof(buf)))
+		return -1;
+	return parse_cpulist(buf, res, max);
+}
+
+/*
+ * The first CPU of a core stands for the core
+ */
+static int is_core_leader(int cpu)
+{
+	char path[128];
+	int siblings[CPU_SETSIZE];
+
+	snprintf(path, sizeof(path),
+			"/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+			cpu);
+	if (read_cpulist(path, siblings, CPU_SETSIZE) <= 0)
+		return 1;
+	return siblings[0] == cpu;
+}
+
+/*
+ * Keep the candidates in order, the core leaders before the siblings
+ */
+static void cores_first(int *cand, int count)
+{
+	int i, n = 0, rest = 0, siblings[CPU_SETSIZE];
+
+	for (i = 0; i < count; i++) {
+		if (is_core_leader(cand[i]))
+			cpus[n++] = cand[i];
+		else
+			siblings[rest++] = cand[i];
+	}
+	memcpy(&cpus[n], siblings, rest * sizeof(int));
+	cpu_count = n + rest;
+}
+
+static int nic_node_cpus(char *if_name, int *res)
+{
+	char path[128], buf[16];
+	int node;
+
+	if (!if_name) {
+		lancet_fprintf(stderr, "nic placement needs the -n interface\n");
+		return -1;
+	}
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node",
+			if_name);
+	if (read_sysfs(path, buf, sizeof(buf)) || (atoi(buf) < 0)) {
+		lancet_fprintf(stderr, "%s has no NUMA node, using all CPUs\n",
+				if_name);
+		return read_cpulist("/sys/devices/system/cpu/online", res,
+				CPU_SETSIZE);
+	}
+	node = atoi(buf);
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+			node);
+	return read_cpulist(path, res, CPU_SETSIZE);
+}
+
+/*
+ * Without the node sysfs every CPU is on node 0
+ */
+static void read_nodes(void)
+{
+	char path[128];
+	int i, j, count, nodes[CPU_SETSIZE], node_cpus[CPU_SETSIZE];
+
+	count = read_cpulist("/sys/devices/system/node/online", nodes,
+			CPU_SETSIZE);
+	for (i = 0; i < count; i++) {
+		snprintf(path, sizeof(path),
+				"/sys/devices/system/node/node%d/cpulist", nodes[i]);
+		for (j = read_cpulist(path, node_cpus, CPU_SETSIZE) - 1; j >= 0; j--)
+			cpu_node[node_cpus[j]] = nodes[i];
+		if (nodes[i] >= node_count)
+			node_count = nodes[i] + 1;
+	}
+}
+
+/*
+ * The user given CPUs index the per-CPU tables and the cpu sets
+ */
+static int check_cpus(int *list, int count)
+{
+	int i, online_count, online[CPU_SETSIZE];
+	cpu_set_t set;
+
+	online_count = read_cpulist("/sys/devices/system/cpu/online", online,
+			CPU_SETSIZE);
+	CPU_ZERO(&set);
+	for (i = 0; i < online_count; i++)
+		if ((online[i] >= 0) && (online[i] < CPU_SETSIZE))
+			CPU_SET(online[i], &set);
+	for (i = 0; i < count; i++) {
+		if ((list[i] < 0) || (list[i] >= CPU_SETSIZE) ||
+				!CPU_ISSET(list[i], &set)) {
+			lancet_fprintf(stderr, "CPU %d is not online\n", list[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int placement_init(char *policy, char *manager_cpus, char *if_name,
+		int thread_count)
+{
+	int i, j, count, cand[CPU_SETSIZE];
+	int allowed_count = 0;
+	cpu_set_t set;
+
+	if (!policy || !strcmp(policy, "seq") || !strcmp(policy, "core"))
+		count = read_cpulist("/sys/devices/system/cpu/online", cand,
+				CPU_SETSIZE);
+	else if (!strcmp(policy, "nic"))
+		count = nic_node_cpus(if_name, cand);
+	else if (!strncmp(policy, "list:", 5)) {
+		count = parse_cpulist(policy + 5, cand, CPU_SETSIZE);
+		if (check_cpus(cand, count))
+			return -1;
+	} else {
+		lancet_fprintf(stderr, "Unknown placement %s\n", policy);
+		return -1;
+	}
+	if (count <= 0) {
+		lancet_fprintf(stderr, "No CPUs to place the threads on\n");
+		return -1;
+	}
+
+	if (manager_cpus) {
+		reserved_count = parse_cpulist(manager_cpus, reserved,
+				CPU_SETSIZE);
+		if (check_cpus(reserved, reserved_count))
+			return -1;
+		CPU_ZERO(&set);
+		for (i = 0; i < reserved_count; i++)
+			CPU_SET(reserved[i], &set);
+		/* The manager runs on the main thread */
+		if (sched_setaffinity(0, sizeof(cpu_set_t), &set)) {
+			lancet_perror("sched_setaffinity");
+			return -1;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < reserved_count; j++)
+			if (cand[i] == reserved[j])
+				break;
+		if (j == reserved_count)
+			cand[allowed_count++] = cand[i];
+	}
+	if (!allowed_count) {
+		lancet_fprintf(stderr, "All the CPUs are reserved for the manager\n");
+		return -1;
+	}
+
+	if (policy && (!strcmp(policy, "core") || !strcmp(policy, "nic")))
+		cores_first(cand, allowed_count);
+	else {
+		memcpy(cpus, cand, allowed_count * sizeof(int));
+		cpu_count = allowed_count;
+	}
+	if (thread_count > cpu_count)
+		lancet_fprintf(stderr, "%d threads on %d CPUs, some will share\n",
+				thread_count, cpu_count);
+	read_nodes();
+	return 0;
+}
+
+int placement_cpu(int thread)
+{
+	return cpus[thread % cpu_count];
+}
+
+int placement_node(int thread)
+{
+	return cpu_node[placement_cpu(thread)];
+}
+
+int placement_node_count(void)
+{
+	return node_count;
+}
+
+int placement_idle_cpus(int thread_count, int *res, int max)
+{
+	int i, count, online[CPU_SETSIZE], idle = 0;
+	cpu_set_t busy;
+
+	CPU_ZERO(&busy);
+	for (i = 0; i < thread_count; i++)
+		CPU_SET(placement_cpu(i), &busy);
+	for (i = 0; i < reserved_count; i++)
+		CPU_SET(reserved[i], &busy);
+	count = read_cpulist("/sys/devices/system/cpu/online", online,
+			CPU_SETSIZE);
+	for (i = 0; (i < count) && (idle < max); i++)
+		if (!CPU_ISSET(online[i], &busy))
+			res[idle++] = online[i];
+	return idle;
+}
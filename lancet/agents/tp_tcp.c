@@ -41,198 +41,654 @@
 #include <lancet/misc.h>
 #include <lancet/manager.h>
 #include <lancet/timestamping.h>
+#include <lancet/conn_select.h>
+#include <lancet/arena.h>
+#include <lancet/req_kernel.h>
 
 static __thread struct tcp_connection *connections;
 static __thread int epoll_fd;
 static __thread struct pending_tx_timestamps *per_conn_tx_timestamps;
 static __thread int avail_reqs;
+static __thread uint32_t conn_base;
+static __thread int thread_conns;
+static __thread struct loop_stats *loop_s;
+static __thread int loop_busy;
+static __thread long loop_window_since; // the due send waits since
+static __thread long loop_window_debt; // the schedule lost waiting
+static __thread struct req_kernel kernel;
+
+/*
+ * Tenants: every tenant runs its own arrivals on every thread and the
+ * loops send for the one that is due first, on one of its connections
+ * and with its protocol. The loop's next_tx is the one of tenant_due.
+ */
+static __thread struct tenant *tenants;
+static __thread int tenant_count;
+static __thread long *tenant_tx;
+static __thread int tenant_due;
+static __thread int *tenant_avail; // avail_reqs of the tenant's connections
+
+/*
+ * Connection lifecycle. Broken connections are closed and reconnected in
+ * the background by maintain_connections(), which the agent loops call
+ * on every iteration. The selection layer is told about every change.
+ */
+static __thread int down_count;
+static __thread int connecting_count;
+static __thread int reconnect_fd;
+static __thread long next_maintain;
+static __thread int (*setup_conn)(struct tcp_connection *conn);
+static __thread struct arena conn_arena;
+
+#define MAX_INFLIGHT_CONNECTS 512
+#define CONNECT_BACKOFF_MIN 10000000L
+#define CONNECT_BACKOFF_MAX 1000000000L
+#define CONNECT_DEADLINE 120000000000L
+#define MAINTAIN_INTERVAL 1000000L
+/* Events handled per loop, so that replies don't delay the next send */
+#define EVENT_BUDGET 16
+
+/*
+ * Block while there is no load, waking up to reconnect if needed
+ */
+static inline void idle_wait(void)
+{
+	wait_for_phase(down_count ? MAINTAIN_INTERVAL : 0);
+}
+
+/*
+ * Loop telemetry, an iteration is idle if it didn't send or receive
+ */
+static inline void loop_begin(void)
+{
+	loop_s->iterations++;
+	loop_busy = 0;
+}
+
+/*
+ * The time the sends waited for a connection to have room is the
+ * server's, the lag of the loop leaves it out until it catches up
+ */
+static inline void loop_sent(long lag)
+{
+	loop_s->sends++;
+	if (loop_window_since) {
+		loop_window_debt += time_ns() - loop_window_since;
+		loop_window_since = 0;
+	}
+	if (loop_window_debt > lag)
+		loop_window_debt = lag > 0 ? lag : 0;
+	lag -= loop_window_debt;
+	hist_add(&loop_s->lag, lag > UINT32_MAX ? UINT32_MAX : lag);
+	loop_busy = 1;
+}
+
+/* The due send waits for a connection below max_pending */
+static inline void loop_window_full(void)
+{
+	if (loop_window_since)
+		return;
+	loop_s->window_full++;
+	loop_window_since = time_ns();
+}
+
+static inline void loop_polled(int ready)
+{
+	if (ready <= 0)
+		return;
+	loop_s->wakeups++;
+	loop_s->events += ready;
+	loop_busy = 1;
+}
+
+static inline void loop_end(void)
+{
+	loop_s->idle_iterations += !loop_busy;
+}
+
+/*
+ * Agent-wide connection index used to tag the samples
+ */
+static inline uint32_t conn_id(struct tcp_connection *conn)
+{
+	return conn_base + conn->idx;
+}
 
 static inline struct tcp_connection *pick_conn()
 {
-	int idx, i;
-	struct tcp_connection *c;
+	if (tenant_count)
+		return select_tenant_conn(tenant_due);
+	return select_conn();
+}
+
+/*
+ * The send time of the first request after the load starts
+ */
+static inline long first_tx(void)
+{
+	long now = time_ns();
+	int i;
+
+	for (i = 0; i < tenant_count; i++)
+		tenant_tx[i] = now;
+	tenant_due = 0;
+	return now;
+}
 
-	// try 10 times
-	for (i=0;i<10;i++) {
-		idx = rand() % (get_conn_count() / get_thread_count()) ;
-		c = &connections[idx];
-		if ((c->pending_reqs < MAX_PENDING_REQS) && (!c->closed))
-			return c;
+/*
+ * The send time of the request after the one at next_tx
+ */
+static __always_inline long next_tx_after(long next_tx,
+		const enum rand_kind kind)
+{
+	int i;
+
+	if (!tenant_count)
+		return kernel_next_tx(&kernel, next_tx, kind);
+	tenant_tx[tenant_due] = get_tenant_next_tx(tenant_due, next_tx);
+	for (i = 0; i < tenant_count; i++)
+		if (tenant_tx[i] < tenant_tx[tenant_due])
+			tenant_due = i;
+	return tenant_tx[tenant_due];
+}
+
+/*
+ * No connection can take the request. It is a pick failure only if some
+ * connection had room, otherwise the server is saturated. A tenant drops
+ * the request, so that a saturated tenant doesn't hold back the others.
+ */
+static __always_inline void pick_failed(long *next_tx,
+		const enum rand_kind kind)
+{
+	if (tenant_count ? tenant_avail[tenant_due] : avail_reqs)
+		loop_s->pick_failures++;
+	else
+		loop_window_full();
+	if (tenant_count) {
+		loop_window_since = 0;
+		*next_tx = next_tx_after(*next_tx, kind);
 	}
-	return NULL;
 }
 
-static int latency_open_connections(void)
+static __always_inline struct request *conn_request(
+		struct tcp_connection *conn, const enum app_proto_type type)
 {
-	struct sockaddr_in addr;
-	int i, ret, sock, per_thread_conn, million = 1e6, one = 1, dest_idx;
-	struct linger linger;
+	if (tenant_count)
+		kernel.proto = tenants[conn->tenant].app_proto;
+	return kernel_request(&kernel, type);
+}
+
+static inline void conn_sent(struct tcp_connection *conn)
+{
+	conn->pending_reqs++;
+	avail_reqs--;
+	if (tenant_count)
+		tenant_avail[conn->tenant]--;
+	select_update(conn);
+}
+
+static inline void conn_completed(struct tcp_connection *conn, int reqs)
+{
+	conn->pending_reqs -= reqs;
+	avail_reqs += reqs;
+	if (tenant_count)
+		tenant_avail[conn->tenant] += reqs;
+	select_update(conn);
+}
+
+/*
+ * Start a non-blocking connect and wait for it with EPOLLOUT in efd.
+ * Returns the socket or -1 with errno set.
+ */
+static int nb_connect(struct host_tuple *target, int efd, uint32_t idx)
+{
+	struct epoll_event event;
+	int sock, ret, err, one = 1;
+
+	sock = socket(target->addr.ss_family, target->socktype | SOCK_NONBLOCK,
+			0);
+	if (sock < 0)
+		return -1;
+
+	/*
+	 * Pick the port at connect time, so that the 4-tuple and not the
+	 * source port alone has to be unique
+	 */
+	if (target->src_len) {
+		setsockopt(sock, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one,
+				sizeof(one));
+		if (bind(sock, (struct sockaddr *)&target->src, target->src_len))
+			goto err;
+	}
+
+	/* A full unix listen backlog fails with EAGAIN and is retried */
+	ret = connect(sock, (struct sockaddr *)&target->addr, target->addr_len);
+	if (ret && errno != EINPROGRESS)
+		goto err;
+
+	event.events = EPOLLOUT;
+	event.data.u32 = idx;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, sock, &event))
+		goto err;
+	return sock;
+err:
+	err = errno;
+	close(sock);
+	errno = err;
+	return -1;
+}
+
+static void retry_later(struct tcp_connection *conn, long now)
+{
+	long backoff;
+
+	backoff = CONNECT_BACKOFF_MIN << (conn->attempts < 7 ? conn->attempts : 7);
+	if (backoff > CONNECT_BACKOFF_MAX)
+		backoff = CONNECT_BACKOFF_MAX;
+	/* Jitter, so that the retries to a target don't come in bursts */
+	conn->retry_at = now + backoff / 2 + rand() % (backoff / 2);
+	conn->attempts++;
+	conn->state = CONN_CLOSED;
+	add_connect_retry(conn->target);
+}
+
+static void conn_up(struct tcp_connection *conn)
+{
+	conn->state = CONN_OPEN;
+	conn->opened = 1;
+	conn->attempts = 0;
+	select_update(conn);
+	down_count--;
+	add_target_ready(conn->target);
+}
+
+/*
+ * The connection broke: drop its pending requests and reconnect later
+ */
+static void conn_down(struct tcp_connection *conn)
+{
+	assert(conn->state == CONN_OPEN);
+	close(conn->fd);
+	avail_reqs += conn->pending_reqs;
+	if (tenant_count)
+		tenant_avail[conn->tenant] += conn->pending_reqs;
+	conn->pending_reqs = 0;
+	conn->rx_head = 0;
+	conn->rx_tail = 0;
+	conn->retry_at = time_ns() + CONNECT_BACKOFF_MIN;
+	conn->state = CONN_CLOSED;
+	select_update(conn);
+	down_count++;
+	remove_target_ready(conn->target);
+}
+
+/*
+ * Nothing was sent if the socket is full, otherwise the stream is broken
+ */
+static void send_failed(struct tcp_connection *conn, int ret)
+{
+	add_failed_send();
+	if ((ret < 0) && (errno == EWOULDBLOCK))
+		return;
+	conn_down(conn);
+}
+
+/*
+ * Complete the connects in flight and start the ones that are due,
+ * waiting at most timeout ms for the former
+ */
+static void maintain_connections(int timeout)
+{
+	struct epoll_event events[64];
+	struct tcp_connection *conn;
 	struct host_tuple *targets;
+	int i, ready, sock, error;
+	socklen_t errlen;
+	long now;
 
-	addr.sin_family = AF_INET;
+	if (!down_count)
+		return;
+	now = time_ns();
+	if (!timeout && (now < next_maintain))
+		return;
+	next_maintain = now + MAINTAIN_INTERVAL;
+
+	ready = epoll_wait(reconnect_fd, events, 64, timeout);
+	for (i = 0; i < ready; i++) {
+		conn = &connections[events[i].data.u32];
+		epoll_ctl(reconnect_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+		connecting_count--;
+		error = 0;
+		errlen = sizeof(error);
+		if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &errlen) ||
+				error || setup_conn(conn)) {
+			close(conn->fd);
+			retry_later(conn, time_ns());
+			continue;
+		}
+		if (conn->opened)
+			add_reconnect();
+		conn_up(conn);
+	}
 
-	per_thread_conn = get_conn_count() / get_thread_count();
-	connections = calloc(per_thread_conn, sizeof(struct tcp_connection));
+	now = time_ns();
 	targets = get_targets();
-
-	for (i = 0; i < per_thread_conn; i++) {
-		sock = socket(AF_INET, SOCK_STREAM, 0);
-		if (sock == -1) {
-			lancet_perror("Error creating socket");
-			return -1;
+	for (i = 0; i < thread_conns; i++) {
+		if (connecting_count == MAX_INFLIGHT_CONNECTS)
+			break;
+		conn = &connections[i];
+		if ((conn->state != CONN_CLOSED) || (conn->retry_at > now))
+			continue;
+		sock = nb_connect(&targets[conn->target], reconnect_fd, i);
+		if (sock < 0) {
+			retry_later(conn, now);
+			continue;
 		}
-		dest_idx = i % get_target_count();
-		addr.sin_port = htons(targets[dest_idx].port);
-		addr.sin_addr.s_addr = targets[dest_idx].ip;
-		ret = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
-		if (ret) {
-			lancet_perror("Error connecting");
+		conn->fd = sock;
+		conn->state = CONN_CONNECTING;
+		connecting_count++;
+	}
+}
+
+/*
+ * The receive buffers and the tx timestamp rings of the thread's
+ * connections are slabs of one arena, allocated after the thread is
+ * pinned so that its pages are local.
+ */
+static int alloc_conn_buffers(int count)
+{
+	size_t ring_size = 0;
+	int i;
+
+	if (per_conn_tx_timestamps)
+		ring_size = get_max_pending() * sizeof(struct timestamp_info);
+	/* Every slab may be padded up to a cache line */
+	if (arena_init(&conn_arena, count * (get_rx_buf_size() + ring_size + 128)))
+		return -1;
+	for (i = 0; i < count; i++) {
+		connections[i].buffer = arena_alloc(&conn_arena, get_rx_buf_size());
+		assert(connections[i].buffer);
+		if (!per_conn_tx_timestamps)
+			continue;
+		per_conn_tx_timestamps[i].pending = arena_alloc(&conn_arena,
+				ring_size);
+		assert(per_conn_tx_timestamps[i].pending);
+		per_conn_tx_timestamps[i].mask = get_max_pending() - 1;
+	}
+	return 0;
+}
+
+/*
+ * Receive after the bytes not parsed yet and consume the complete
+ * responses, so a response can span any number of reads. The unparsed
+ * bytes only move back to the start of the buffer when they reach its
+ * end. Returns what recv returned.
+ */
+static __always_inline int conn_recv_kernel(struct tcp_connection *conn,
+		struct byte_req_pair *read_res, struct timestamp_info *rx_timestamp,
+		const enum app_proto_type type)
+{
+	uint32_t size = get_rx_buf_size();
+	int ret;
+
+	read_res->bytes = 0;
+	read_res->reqs = 0;
+	if (conn->rx_tail == size) {
+		if (!conn->rx_head) {
+			lancet_fprintf(stderr, "Response larger than the %u byte "
+					"receive buffer, raise -l\n", size);
+			errno = EMSGSIZE;
 			return -1;
 		}
-		/* Disable Nagle */
-		ret = setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		memmove(conn->buffer, &conn->buffer[conn->rx_head],
+				conn->rx_tail - conn->rx_head);
+		conn->rx_tail -= conn->rx_head;
+		conn->rx_head = 0;
+	}
+
+	if (rx_timestamp)
+		ret = timestamp_recv(conn->fd, &conn->buffer[conn->rx_tail],
+				size - conn->rx_tail, 0, rx_timestamp);
+	else
+		ret = recv(conn->fd, &conn->buffer[conn->rx_tail],
+				size - conn->rx_tail, 0);
+	if (ret <= 0)
+		return ret;
+
+	conn->rx_tail += ret;
+	if (tenant_count)
+		kernel.proto = tenants[conn->tenant].app_proto;
+	*read_res = kernel_response(&kernel, type, &conn->buffer[conn->rx_head],
+			conn->rx_tail - conn->rx_head);
+	conn->rx_head += read_res->bytes;
+	if (conn->rx_head == conn->rx_tail) {
+		conn->rx_head = 0;
+		conn->rx_tail = 0;
+	}
+	return ret;
+}
+
+static int conn_recv(struct tcp_connection *conn,
+		struct byte_req_pair *read_res, struct timestamp_info *rx_timestamp)
+{
+	return conn_recv_kernel(conn, read_res, rx_timestamp, PROTO_NR);
+}
+
+/*
+ * All the connections of the thread are opened in parallel. Targets
+ * that refuse or drop the connection, e.g. VMs that are still booting,
+ * are retried with exponential backoff. After CONNECT_DEADLINE the agent
+ * starts with the connections it has and keeps retrying the others in
+ * the background.
+ */
+static int open_connections(int per_thread_conn,
+		int (*setup)(struct tcp_connection *conn))
+{
+	int i;
+	long deadline;
+
+	connections = calloc(per_thread_conn, sizeof(struct tcp_connection));
+	if (!connections) {
+		lancet_fprintf(stderr, "Failed to allocate connections\n");
+		return -1;
+	}
+	reconnect_fd = epoll_create(1);
+	if (reconnect_fd < 0) {
+		lancet_perror("epoll_create error");
+		return -1;
+	}
+	conn_base = get_thread_conn_base(get_agent_tid());
+	thread_conns = per_thread_conn;
+	loop_s = get_loop_stats(get_agent_tid());
+	setup_conn = setup;
+	tenants = get_tenants();
+	tenant_count = get_tenant_count();
+	tenant_tx = calloc(tenant_count, sizeof(long));
+	tenant_avail = calloc(tenant_count, sizeof(int));
+	if (!tenant_tx || !tenant_avail) {
+		lancet_fprintf(stderr, "Failed to allocate the tenants\n");
+		return -1;
+	}
+	if (alloc_conn_buffers(per_thread_conn))
+		return -1;
+
+	for (i = 0; i < per_thread_conn; i++) {
+		connections[i].idx = i;
+		connections[i].target = i % get_target_count();
+		connections[i].state = CONN_CLOSED;
+	}
+	down_count = per_thread_conn;
+	if (select_init(connections, per_thread_conn))
+		return -1;
+
+	deadline = time_ns() + CONNECT_DEADLINE;
+	while (down_count && (time_ns() < deadline))
+		maintain_connections(1);
+
+	if (down_count)
+		lancet_fprintf(stderr, "Only %d out of %d connections established, "
+				"retrying in the background\n", per_thread_conn - down_count,
+				per_thread_conn);
+	return 0;
+}
+
+static int latency_setup_conn(struct tcp_connection *conn)
+{
+	int ret, million = 1e6, one = 1;
+	struct linger linger;
+
+	/* The latency agent waits for every reply */
+	ret = fcntl(conn->fd, F_SETFL, 0);
+	if (ret == -1) {
+		lancet_perror("Error while setting blocking");
+		return -1;
+	}
+	/* Disable Nagle */
+	if (target_is_inet(&get_targets()[conn->target])) {
+		ret = setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one,
+				sizeof(one));
 		if (ret) {
 			lancet_perror("Error setsockopt TCP_NODELAY");
 			return -1;
 		}
-		/* Close with RST not FIN */
-		linger.l_onoff = 1;
-		linger.l_linger = 0;
-		if (setsockopt(sock, SOL_SOCKET, SO_LINGER, (void *)&linger,
-					   sizeof(linger))) {
-			perror("setsockopt(SO_LINGER)");
-			exit(1);
-		}
-		/* Enable busy polling */
-		ret = setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &million,
-						 sizeof(million));
-		if (ret) {
-			lancet_perror("Error setsockopt SO_BUSY_POLL");
-			return -1;
-		}
-		connections[i].fd = sock;
-		connections[i].closed = 0;
+	}
+	/* Close with RST not FIN */
+	linger.l_onoff = 1;
+	linger.l_linger = 0;
+	if (setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, (void *)&linger,
+				   sizeof(linger))) {
+		lancet_perror("setsockopt(SO_LINGER)");
+		return -1;
+	}
+	/* Enable busy polling */
+	ret = setsockopt(conn->fd, SOL_SOCKET, SO_BUSY_POLL, &million,
+					 sizeof(million));
+	if (ret) {
+		lancet_perror("Error setsockopt SO_BUSY_POLL");
+		return -1;
+	}
 #if 0
-		if (dest_idx == 0)
-			t_ctx->connections[i].master_conn = NULL;
-		else
-			t_ctx->connections[i].master_conn = &t_ctx->connections[i - dest_idx];
+	if (dest_idx == 0)
+		t_ctx->connections[i].master_conn = NULL;
+	else
+		t_ctx->connections[i].master_conn = &t_ctx->connections[i - dest_idx];
 #endif
-	}
 	return 0;
 }
 
-static int throughput_open_connections(void)
+static int latency_open_connections(void)
 {
-	/*init epoll*/
-	struct sockaddr_in addr;
-	int i, efd, ret, sock, per_thread_conn,dest_idx,n;
-	int one = 1;
+	return open_connections(get_thread_conn_count(get_agent_tid()),
+			latency_setup_conn);
+}
+
+static int throughput_setup_conn(struct tcp_connection *conn)
+{
+	int ret, n, one = 1;
+	int inet = target_is_inet(&get_targets()[conn->target]);
 	struct epoll_event event;
 	struct linger linger;
-	struct host_tuple *targets;
 
-	addr.sin_family = AF_INET;
-	efd = epoll_create(1);
-	if (efd < 0) {
-		lancet_perror("epoll_create error");
+	n = 524288;
+	ret = setsockopt(conn->fd, SOL_SOCKET, SO_SNDBUF, &n, sizeof(n));
+	if (ret) {
+		lancet_perror("Error setsockopt");
 		return -1;
 	}
-
-	per_thread_conn = get_conn_count() / get_thread_count();
-	avail_reqs = per_thread_conn * MAX_PENDING_REQS;
-	connections = calloc(per_thread_conn, sizeof(struct tcp_connection));
-	assert(connections);
-	if ((get_agent_type() == SYMMETRIC_NIC_TIMESTAMP_AGENT) || (get_agent_type() == SYMMETRIC_AGENT)) {
-		per_conn_tx_timestamps= calloc(per_thread_conn, sizeof(struct pending_tx_timestamps));
-		assert(per_conn_tx_timestamps);
+	n = 524288;
+	ret = setsockopt(conn->fd, SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+	if (ret) {
+		lancet_perror("Error setsockopt");
+		return -1;
 	}
-	targets = get_targets();
 
-	for (i = 0; i < per_thread_conn; i++) {
-		sock = socket(AF_INET, SOCK_STREAM, 0);
-		if (sock == -1) {
-			lancet_perror("Error creating socket");
+	if (kernel_timestamping(get_agent_type())) {
+		if (!inet) {
+			lancet_fprintf(stderr, "Kernel timestamping needs an IP target\n");
 			return -1;
 		}
-		dest_idx = i % get_target_count();
-		addr.sin_port = htons(targets[dest_idx].port);
-		addr.sin_addr.s_addr = targets[dest_idx].ip;
-		ret = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
-		if (ret) {
-			lancet_perror("Error connecting");
-			return -1;
-		}
-		ret = fcntl(sock, F_SETFL, O_NONBLOCK);
-		if (ret == -1) {
-			lancet_perror("Error while setting nonblocking");
-			return -1;
-		}
-		n = 524288;
-		ret = setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &n, sizeof(n));
-		if (ret) {
-			lancet_perror("Error setsockopt");
+		if (get_if_name() && setsockopt(conn->fd, SOL_SOCKET,
+					SO_BINDTODEVICE, get_if_name(),
+					strlen(get_if_name()))) {
+			lancet_perror("setsockopt SO_BINDTODEVICE");
 			return -1;
 		}
-		n = 524288;
-		ret = setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+		ret = sock_enable_timestamping(conn->fd,
+				get_agent_type() == SYMMETRIC_NIC_TIMESTAMP_AGENT);
 		if (ret) {
-			lancet_perror("Error setsockopt");
+			lancet_fprintf(stderr, "sock enable timestamping failed\n");
 			return -1;
 		}
+	}
 
-		if(get_agent_type() == SYMMETRIC_NIC_TIMESTAMP_AGENT) {
-			if(setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, IF_NAME, strlen(IF_NAME))) {
-				lancet_perror("setsockopt SO_BINDTODEVICE");
-				return -1;
-			}
-			ret = sock_enable_timestamping(sock);
-			if (ret) {
-				lancet_fprintf(stderr, "sock enable timestamping failed\n");
-				return -1;
-			}
-		}
-
-		/* Disable Nagle's algorithm */
-		ret = setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	/* Disable Nagle's algorithm */
+	if (inet) {
+		ret = setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one,
+				sizeof(one));
 		if (ret) {
 			lancet_perror("Error setsockopt");
 			return -1;
 		}
+	}
 
-		/* Close with RST not FIN */
-		linger.l_onoff = 1;
-		linger.l_linger = 0;
-		if (setsockopt(sock, SOL_SOCKET, SO_LINGER, (void *)&linger,
-					   sizeof(linger))) {
-			perror("setsockopt(SO_LINGER)");
-			exit(1);
-		}
-		event.events = EPOLLIN;
-		event.data.u32 = i;
-		ret = epoll_ctl(efd, EPOLL_CTL_ADD, sock, &event);
-		if (ret) {
-			lancet_perror("Error while adding to epoll group");
-			return -1;
-		}
-		connections[i].fd = sock;
-		connections[i].pending_reqs = 0;
-		connections[i].idx = i;
-		connections[i].buffer_idx = 0;
-		connections[i].closed = 0;
+	/* Close with RST not FIN */
+	linger.l_onoff = 1;
+	linger.l_linger = 0;
+	if (setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, (void *)&linger,
+				   sizeof(linger))) {
+		lancet_perror("setsockopt(SO_LINGER)");
+		return -1;
+	}
+	event.events = EPOLLIN;
+	event.data.u32 = conn->idx;
+	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+	if (ret) {
+		lancet_perror("Error while adding to epoll group");
+		return -1;
+	}
+	if (per_conn_tx_timestamps)
+		reset_tx_timestamps(&per_conn_tx_timestamps[conn->idx]);
+	conn->pending_reqs = 0;
+	conn->rx_head = 0;
+	conn->rx_tail = 0;
 #if 0
-		// FIXME: Use app proto meta to pick a connection
-		if (dest_idx == 0)
-			t_ctx->connections[i].master_conn = NULL;
-		else
-			t_ctx->connections[i].master_conn = &t_ctx->connections[i - dest_idx];
+	// FIXME: Use app proto meta to pick a connection
+	if (dest_idx == 0)
+		t_ctx->connections[i].master_conn = NULL;
+	else
+		t_ctx->connections[i].master_conn = &t_ctx->connections[i - dest_idx];
 #endif
+	return 0;
+}
+
+static int throughput_open_connections(void)
+{
+	int per_thread_conn, i;
+
+	/*init epoll*/
+	epoll_fd = epoll_create(1);
+	if (epoll_fd < 0) {
+		lancet_perror("epoll_create error");
+		return -1;
+	}
+
+	per_thread_conn = get_thread_conn_count(get_agent_tid());
+	avail_reqs = per_thread_conn * get_max_pending();
+	if (kernel_timestamping(get_agent_type()) || (get_agent_type() == SYMMETRIC_AGENT)) {
+		per_conn_tx_timestamps= calloc(per_thread_conn, sizeof(struct pending_tx_timestamps));
+		assert(per_conn_tx_timestamps);
 	}
-	epoll_fd = efd;
+
+	if (open_connections(per_thread_conn, throughput_setup_conn))
+		return -1;
+	for (i = 0; i < per_thread_conn && tenant_count; i++)
+		tenant_avail[connections[i].tenant] += get_max_pending();
 	return 0;
 }
 
-static void throughput_tcp_main(void) {
+static __always_inline void throughput_loop(const enum app_proto_type type,
+		const enum rand_kind kind)
+{
 	int ready, idx, i, conn_per_thread, ret, bytes_to_send;
 	long next_tx, diff;
 	struct epoll_event *events;
@@ -245,32 +701,36 @@ static void throughput_tcp_main(void) {
 		return;
 
 	/*Initializations*/
-	conn_per_thread = get_conn_count() / get_thread_count();
+	conn_per_thread = thread_conns;
 	events = malloc(conn_per_thread * sizeof(struct epoll_event));
 
-	next_tx = time_ns();
+	next_tx = first_tx();
 	while (1) {
+		maintain_connections(0);
 		if (!should_load()) {
-			next_tx = time_ns();
+			idle_wait();
+			next_tx = first_tx();
 			continue;
 		}
+		loop_begin();
 		diff = time_ns() - next_tx;
 		if (diff >= 0) {
 			conn = pick_conn();
-			if (!conn)
+			if (!conn) {
+				pick_failed(&next_tx, kind);
 				goto REP_PROC;
-			to_send = prepare_request();
+			}
+			to_send = conn_request(conn, type);
 			bytes_to_send = 0;
 			for (i=0;i<to_send->iov_cnt;i++)
 				bytes_to_send += to_send->iovs[i].iov_len;
 			ret = writev(conn->fd, to_send->iovs, to_send->iov_cnt);
-			if ((ret < 0) && (errno != EWOULDBLOCK)) {
-				lancet_perror("Unknown connection error write\n");
-				return;
+			if (ret != bytes_to_send) {
+				send_failed(conn, ret);
+				goto REP_PROC;
 			}
-			assert(ret == bytes_to_send);
-			conn->pending_reqs++;
-			avail_reqs--;
+			conn_sent(conn);
+			loop_sent(diff);
 
 			/*BookKeeping*/
 			send_res.bytes = ret;
@@ -278,59 +738,45 @@ static void throughput_tcp_main(void) {
 			add_throughput_tx_sample(send_res);
 
 			/*Schedule next*/
-			next_tx += get_ia();
+			next_tx = next_tx_after(next_tx, kind);
 		}
 	REP_PROC:
 		/* process responses */
 		ready = epoll_wait(epoll_fd, events, conn_per_thread, 0);
+		loop_polled(ready);
 		for (i = 0; i < ready; i++) {
 			idx = events[i].data.u32;
 			conn = &connections[idx];
+			if (conn->state != CONN_OPEN)
+				continue;
 			/* Handle incoming packet */
 			if (events[i].events & EPOLLIN) {
 				// read into the connection buffer
-				ret = recv(conn->fd, &conn->buffer[conn->buffer_idx],
-						MAX_PAYLOAD-conn->buffer_idx, 0);
-				if ((ret < 0) && (errno != EWOULDBLOCK)) {
-					lancet_perror("Unknow connection error read\n");
-					return;
-				}
-				if (ret == 0) {
-					close(conn->fd);
-					lancet_fprintf(stderr, "Connection closed\n");
-					conn->closed = 1;
+				ret = conn_recv_kernel(conn, &read_res, NULL, type);
+				if ((ret < 0) && (errno == EWOULDBLOCK))
+					continue;
+				if (ret <= 0) {
+					conn_down(conn);
 					continue;
 				}
-				conn->buffer_idx += ret;
-				read_res = process_response(conn->buffer, conn->buffer_idx);
-				if (read_res.bytes == conn->buffer_idx)
-					conn->buffer_idx = 0;
-				else if (read_res.bytes < conn->buffer_idx) {
-					lancet_fprintf(stderr, "Received half request\n");
-					memcpy(conn->buffer, &conn->buffer[read_res.bytes],
-							conn->buffer_idx-read_res.bytes);
-					conn->buffer_idx -= read_res.bytes;
-				} else
-					assert(0);
-
-				assert(read_res.reqs > 0);
-				conn->pending_reqs -= read_res.reqs;
-				avail_reqs += read_res.reqs;
+				if (!read_res.reqs)
+					continue;
+				conn_completed(conn, read_res.reqs);
 
 				/* Bookkeeping */
 				add_throughput_rx_sample(read_res);
 
-			} else if (events[i].events & EPOLLHUP)
-				assert(0);
-			else
-				assert(0);
+			} else
+				conn_down(conn);
 		}
+		loop_end();
 	}
 
 	return;
 }
 
-static void latency_tcp_main(void)
+static __always_inline void latency_loop(const enum app_proto_type type,
+		const enum rand_kind kind)
 {
 	int i, ret, bytes_to_send;
 	long now, start_time, end_time, next_tx;
@@ -338,65 +784,73 @@ static void latency_tcp_main(void)
 	struct request *to_send;
 	struct byte_req_pair read_res;
 	struct byte_req_pair send_res;
+	struct timespec tx_timestamp;
 
 	if (latency_open_connections())
 		exit(-1);
 
 	next_tx = time_ns();
 	while (1) {
+		maintain_connections(0);
 		if (!should_load()) {
+			idle_wait();
 			next_tx = time_ns();
 			continue;
 		}
+		loop_begin();
 		now = time_ns();
-		if (now < next_tx)
+		if (now < next_tx) {
+			loop_end();
 			continue;
+		}
 		conn = pick_conn();
-		if (!conn)
+		if (!conn) {
+			loop_s->pick_failures++;
+			loop_end();
 			continue;
-		start_time = time_ns();
+		}
+		time_ns_to_ts(&tx_timestamp);
+		start_time = tx_timestamp.tv_sec * 1000000000L + tx_timestamp.tv_nsec;
 
-		to_send = prepare_request();
+		to_send = conn_request(conn, type);
 		bytes_to_send = 0;
 		for (i=0;i<to_send->iov_cnt;i++)
 			bytes_to_send += to_send->iovs[i].iov_len;
 		ret = writev(conn->fd, to_send->iovs, to_send->iov_cnt);
-		if (ret<0) {
-			lancet_perror("Writev failed\n");
-			return;
+		if (ret != bytes_to_send) {
+			add_failed_send();
+			conn_down(conn);
+			continue;
 		}
-		assert(ret == bytes_to_send);
 		/* Bookkeeping */
 		send_res.bytes = ret;
 		send_res.reqs = 1;
 		add_throughput_tx_sample(send_res);
+		loop_sent(now - next_tx);
 
-		ret = recv(conn->fd, conn->buffer, MAX_PAYLOAD, 0);
-		if (ret < 0) {
-			lancet_perror("Error read\n");
-			return;
-		}
-		if (ret == 0) {
-			close(conn->fd);
-			lancet_fprintf(stderr, "Connection closed\n");
-			conn->closed = 1;
+		do {
+			ret = conn_recv_kernel(conn, &read_res, NULL, type);
+		} while ((ret > 0) && !read_res.reqs);
+		if (ret <= 0) {
+			conn_down(conn);
 			continue;
 		}
-		read_res = process_response(conn->buffer, ret);
-		assert(read_res.bytes == ret);
 		end_time = time_ns();
 		/*BookKeeping*/
 		add_throughput_rx_sample(read_res);
-		add_latency_sample((end_time - start_time), NULL);
+		add_latency_sample((end_time - start_time), &tx_timestamp,
+				conn_id(conn), conn->target);
 
 		/*Schedule next*/
-		next_tx += get_ia();
+		next_tx = next_tx_after(next_tx, kind);
 	}
 	return;
 }
 
-static void symmetric_nic_tcp_main(void) {
-	int ready, idx, i, conn_per_thread, ret, bytes_to_send, error, to_process;
+static __always_inline void symmetric_nic_loop(
+		const enum app_proto_type type, const enum rand_kind kind)
+{
+	int ready, idx, i, conn_per_thread, ret, bytes_to_send, error, budget;
 	long next_tx, diff;
 	struct epoll_event *events;
 	struct tcp_connection *conn;
@@ -411,23 +865,33 @@ static void symmetric_nic_tcp_main(void) {
 		return;
 
 	/*Initializations*/
-	conn_per_thread = get_conn_count() / get_thread_count();
+	conn_per_thread = thread_conns;
 	events = malloc(4 * conn_per_thread * sizeof(struct epoll_event));
+	budget = 4 * conn_per_thread < EVENT_BUDGET ? 4 * conn_per_thread :
+		EVENT_BUDGET;
 
-	next_tx = time_ns();
+	next_tx = first_tx();
 	while (1) {
+		maintain_connections(0);
 		if (!should_load()) {
-			next_tx = time_ns();
+			idle_wait();
+			next_tx = first_tx();
 			continue;
 		}
-		if (!avail_reqs)
+		loop_begin();
+		if (!avail_reqs) {
+			if (time_ns() >= next_tx)
+				loop_window_full();
 			goto REP_PROC;
+		}
 		diff = time_ns() - next_tx;
 		while (diff >= 0) {
 			conn = pick_conn();
-			if (!conn)
+			if (!conn) {
+				pick_failed(&next_tx, kind);
 				goto REP_PROC;
-			to_send = prepare_request();
+			}
+			to_send = conn_request(conn, type);
 
 			// send once
 			bytes_to_send = 0;
@@ -438,14 +902,13 @@ static void symmetric_nic_tcp_main(void) {
 			hdr.msg_iov = to_send->iovs;
 			hdr.msg_iovlen = to_send->iov_cnt;
 			ret = sendmsg(conn->fd, &hdr, 0);
-			if ((ret < 0) && (errno != EWOULDBLOCK)) {
-				lancet_perror("Unknown connection error write\n");
-				return;
+			if (ret != bytes_to_send) {
+				send_failed(conn, ret);
+				goto REP_PROC;
 			}
-			assert(ret == bytes_to_send);
 			add_pending_tx_timestamp(&per_conn_tx_timestamps[conn->idx], bytes_to_send);
-			conn->pending_reqs++;
-			avail_reqs--;
+			conn_sent(conn);
+			loop_sent(diff);
 
 			/*BookKeeping*/
 			send_res.bytes = ret;
@@ -453,53 +916,31 @@ static void symmetric_nic_tcp_main(void) {
 			add_throughput_tx_sample(send_res);
 
 			/*Schedule next*/
-			next_tx += get_ia();
+			next_tx = next_tx_after(next_tx, kind);
 			diff = time_ns() - next_tx;
 		}
 	REP_PROC:
 		/* process responses */
-		//ready = epoll_wait(epoll_fd, events, conn_per_thread, 0);
-		//diff = (-diff) / 2 + 1;
-		//to_process =  (4 * conn_per_thread > diff) ? diff : 4 * conn_per_thread;
-		//to_process = 4 * conn_per_thread;
-		to_process = 1;
-		ready = epoll_wait(epoll_fd, events, to_process, 0);
+		ready = epoll_wait(epoll_fd, events, budget, 0);
+		loop_polled(ready);
 		for (i = 0; i < ready; i++) {
-			//if ((time_ns() - next_tx) > 0)
-			//	break;
 			idx = events[i].data.u32;
 			conn = &connections[idx];
+			if (conn->state != CONN_OPEN)
+				continue;
 			/* Handle incoming packet */
 			if (events[i].events & EPOLLIN) {
 				// read into the connection buffer
-				ret = timestamp_recv(conn->fd, &conn->buffer[conn->buffer_idx],
-						MAX_PAYLOAD-conn->buffer_idx, 0, &rx_timestamp);
-				if ((ret < 0) && (errno != EWOULDBLOCK)) {
-					lancet_perror("Unknow connection error read\n");
-					return;
-				}
-				if (ret == 0) {
-					close(conn->fd);
-					lancet_fprintf(stderr, "Connection closed\n");
-					conn->closed = 1;
+				ret = conn_recv_kernel(conn, &read_res, &rx_timestamp, type);
+				if ((ret < 0) && (errno == EWOULDBLOCK))
+					continue;
+				if (ret <= 0) {
+					conn_down(conn);
 					continue;
 				}
-				conn->buffer_idx += ret;
-				read_res = process_response(conn->buffer, conn->buffer_idx);
-				if (read_res.bytes == conn->buffer_idx)
-					conn->buffer_idx = 0;
-				else if (read_res.bytes < conn->buffer_idx) {
-					lancet_fprintf(stderr, "Received half request: %d %ld\n", conn->buffer_idx, read_res.bytes);
-					assert(0);
-					memcpy(conn->buffer, &conn->buffer[read_res.bytes],
-							conn->buffer_idx-read_res.bytes);
-					conn->buffer_idx -= read_res.bytes;
-				} else
-					assert(0);
-
-				assert(read_res.reqs >= 1);
-				conn->pending_reqs -= read_res.reqs;
-				avail_reqs += read_res.reqs;
+				if (!read_res.reqs)
+					continue;
+				conn_completed(conn, read_res.reqs);
 
 				/*
 				 * Assume only the last request will have an rx timestamp!
@@ -512,13 +953,17 @@ static void symmetric_nic_tcp_main(void) {
 					//lancet_fprintf(stderr, "tid:%d\tTry again...\n", get_agent_tid());
 					ret = get_tx_timestamp(conn->fd, &per_conn_tx_timestamps[conn->idx]);
 					tx_timestamp = pop_pending_tx_timestamps(&per_conn_tx_timestamps[conn->idx]);
-					if (!tx_timestamp)
+					if (!tx_timestamp) {
+						/* The reply beat the TX timestamp, no sample */
 						per_conn_tx_timestamps[conn->idx].consumed++;
+						add_throughput_rx_sample(read_res);
+						continue;
+					}
 				}
 				ret = timespec_diff(&latency, &rx_timestamp.time, &tx_timestamp->time);
 				if (ret == 0) {
 					add_latency_sample(latency.tv_nsec + latency.tv_sec * 1e9,
-							&tx_timestamp->time);
+							&tx_timestamp->time, conn_id(conn), conn->target);
 				}
 
 				/* Bookkeeping */
@@ -528,7 +973,7 @@ static void symmetric_nic_tcp_main(void) {
 				ret = get_tx_timestamp(conn->fd, &per_conn_tx_timestamps[conn->idx]);
 			}
 			else if (events[i].events & EPOLLHUP)
-				assert(0);
+				conn_down(conn);
 			else {
 				error = 0;
 				socklen_t errlen = sizeof(error);
@@ -540,12 +985,15 @@ static void symmetric_nic_tcp_main(void) {
 				//assert(0);
 			}
 		}
+		loop_end();
 	}
 
 	return;
 }
 
-static void symmetric_tcp_main(void) {
+static __always_inline void symmetric_loop(const enum app_proto_type type,
+		const enum rand_kind kind)
+{
 	int ready, idx, i, conn_per_thread, ret, bytes_to_send, error;
 	long next_tx, diff;
 	struct epoll_event *events;
@@ -561,21 +1009,26 @@ static void symmetric_tcp_main(void) {
 		return;
 
 	/*Initializations*/
-	conn_per_thread = get_conn_count() / get_thread_count();
+	conn_per_thread = thread_conns;
 	events = malloc(conn_per_thread * sizeof(struct epoll_event));
 
-	next_tx = time_ns();
+	next_tx = first_tx();
 	while (1) {
+		maintain_connections(0);
 		if (!should_load()) {
-			next_tx = time_ns();
+			idle_wait();
+			next_tx = first_tx();
 			continue;
 		}
+		loop_begin();
 		diff = time_ns() - next_tx;
 		if (diff >= 0) {
 			conn = pick_conn();
-			if (!conn)
+			if (!conn) {
+				pick_failed(&next_tx, kind);
 				goto REP_PROC;
-			to_send = prepare_request();
+			}
+			to_send = conn_request(conn, type);
 
 			// send once
 			bytes_to_send = 0;
@@ -587,14 +1040,13 @@ static void symmetric_tcp_main(void) {
 			hdr.msg_iovlen = to_send->iov_cnt;
 			time_ns_to_ts(&tx_timestamp);
 			ret = sendmsg(conn->fd, &hdr, 0);
-			if ((ret < 0) && (errno != EWOULDBLOCK)) {
-				lancet_perror("Unknown connection error write\n");
-				return;
+			if (ret != bytes_to_send) {
+				send_failed(conn, ret);
+				goto REP_PROC;
 			}
-			assert(ret == bytes_to_send);
 			push_complete_tx_timestamp(&per_conn_tx_timestamps[conn->idx], &tx_timestamp);
-			conn->pending_reqs++;
-			avail_reqs--;
+			conn_sent(conn);
+			loop_sent(diff);
 
 			/*BookKeeping*/
 			send_res.bytes = ret;
@@ -602,47 +1054,32 @@ static void symmetric_tcp_main(void) {
 			add_throughput_tx_sample(send_res);
 
 			/*Schedule next*/
-			next_tx += get_ia();
+			next_tx = next_tx_after(next_tx, kind);
 		}
 	REP_PROC:
 		/* process responses */
 		ready = epoll_wait(epoll_fd, events, conn_per_thread, 0);
+		loop_polled(ready);
 		for (i = 0; i < ready; i++) {
 			idx = events[i].data.u32;
 			conn = &connections[idx];
+			if (conn->state != CONN_OPEN)
+				continue;
 			/* Handle incoming packet */
 			if (events[i].events & EPOLLIN) {
 				// read into the connection buffer
-				ret = recv(conn->fd, &conn->buffer[conn->buffer_idx],
-						MAX_PAYLOAD-conn->buffer_idx, 0);
-				if ((ret < 0) && (errno != EWOULDBLOCK)) {
-					lancet_perror("Unknow connection error read\n");
-					return;
-				}
-				if (ret == 0) {
-					close(conn->fd);
-					lancet_fprintf(stderr, "Connection closed\n");
-					conn->closed = 1;
+				ret = conn_recv_kernel(conn, &read_res, NULL, type);
+				if ((ret < 0) && (errno == EWOULDBLOCK))
+					continue;
+				if (ret <= 0) {
+					conn_down(conn);
 					continue;
 				}
 				time_ns_to_ts(&rx_timestamp);
+				if (!read_res.reqs)
+					continue;
 
-				conn->buffer_idx += ret;
-				read_res = process_response(conn->buffer, conn->buffer_idx);
-				if (read_res.bytes == conn->buffer_idx)
-					conn->buffer_idx = 0;
-				else if (read_res.bytes < conn->buffer_idx) {
-					lancet_fprintf(stderr, "Received half request: %d %ld\n", conn->buffer_idx, read_res.bytes);
-					assert(0);
-					memcpy(conn->buffer, &conn->buffer[read_res.bytes],
-							conn->buffer_idx-read_res.bytes);
-					conn->buffer_idx -= read_res.bytes;
-				} else
-					assert(0);
-
-				assert(read_res.reqs >= 1);
-				conn->pending_reqs -= read_res.reqs;
-				avail_reqs += read_res.reqs;
+				conn_completed(conn, read_res.reqs);
 
 				/*
 				 * Assume only the last request will have an rx timestamp!
@@ -654,7 +1091,8 @@ static void symmetric_tcp_main(void) {
 				ret = timespec_diff(&latency, &rx_timestamp, &pending_tx->time);
 				if (ret == 0) {
 					assert(latency.tv_sec == 0);
-					add_latency_sample(latency.tv_nsec, &pending_tx->time);
+					add_latency_sample(latency.tv_nsec, &pending_tx->time,
+							conn_id(conn), conn->target);
 				}
 
 				/* Bookkeeping */
@@ -664,7 +1102,7 @@ static void symmetric_tcp_main(void) {
 				ret = get_tx_timestamp(conn->fd, &per_conn_tx_timestamps[conn->idx]);
 			}
 			else if (events[i].events & EPOLLHUP)
-				assert(0);
+				conn_down(conn);
 			else {
 				error = 0;
 				socklen_t errlen = sizeof(error);
@@ -676,11 +1114,263 @@ static void symmetric_tcp_main(void) {
 				//assert(0);
 			}
 		}
+		loop_end();
 	}
 
 	return;
 }
 
+/*
+ * The agent loops for every protocol and distribution with a kernel.
+ * Tenants have their own, so they take the generic one.
+ */
+#define KERNEL_LOOP(loop, proto, kind) \
+static void loop##_##proto##_##kind(void) \
+{ \
+	loop##_loop(proto, kind); \
+}
+
+#define KERNEL_LOOPS(loop, proto) \
+	KERNEL_LOOP(loop, proto, RAND_GENERIC) \
+	KERNEL_LOOP(loop, proto, RAND_EXP) \
+	KERNEL_LOOP(loop, proto, RAND_FIXED)
+
+#define KERNEL_ROW(loop, proto) { \
+	[RAND_GENERIC] = loop##_##proto##_RAND_GENERIC, \
+	[RAND_EXP] = loop##_##proto##_RAND_EXP, \
+	[RAND_FIXED] = loop##_##proto##_RAND_FIXED, \
+}
+
+#define KERNEL_TABLE(loop) \
+KERNEL_LOOPS(loop, PROTO_ECHO) \
+KERNEL_LOOPS(loop, PROTO_SYNTHETIC) \
+KERNEL_LOOPS(loop, PROTO_NR) \
+static void (*loop##_kernels[PROTO_NR + 1][RAND_KIND_NR])(void) = { \
+	[PROTO_ECHO] = KERNEL_ROW(loop, PROTO_ECHO), \
+	[PROTO_SYNTHETIC] = KERNEL_ROW(loop, PROTO_SYNTHETIC), \
+	[PROTO_NR] = KERNEL_ROW(loop, PROTO_NR), \
+}; \
+static void loop##_tcp_main(void) \
+{ \
+	kernel_init(&kernel); \
+	if (get_tenant_count()) \
+		loop##_kernels[PROTO_NR][RAND_GENERIC](); \
+	else \
+		loop##_kernels[kernel_proto(kernel.proto->type)][kernel.idist->kind](); \
+}
+
+KERNEL_TABLE(throughput)
+KERNEL_TABLE(latency)
+KERNEL_TABLE(symmetric)
+KERNEL_TABLE(symmetric_nic)
+
+/*
+ * Connection churn: every slot connects to the next target without
+ * blocking, sends one request, waits for the reply and closes.
+ */
+struct connect_slot {
+	long start;
+	struct timespec tx;
+};
+
+static __thread struct connect_slot *slots;
+static __thread uint16_t *free_slots;
+static __thread int free_count;
+
+static int connect_init(void)
+{
+	int i, per_thread_conn;
+
+	epoll_fd = epoll_create(1);
+	if (epoll_fd < 0) {
+		lancet_perror("epoll_create error");
+		return -1;
+	}
+
+	per_thread_conn = get_thread_conn_count(get_agent_tid());
+	thread_conns = per_thread_conn;
+	connections = calloc(per_thread_conn, sizeof(struct tcp_connection));
+	slots = calloc(per_thread_conn, sizeof(struct connect_slot));
+	free_slots = malloc(per_thread_conn * sizeof(uint16_t));
+	if (!connections || !slots || !free_slots) {
+		lancet_fprintf(stderr, "Failed to allocate connect slots\n");
+		return -1;
+	}
+	conn_base = get_thread_conn_base(get_agent_tid());
+	loop_s = get_loop_stats(get_agent_tid());
+	if (alloc_conn_buffers(per_thread_conn))
+		return -1;
+
+	for (i = 0; i < per_thread_conn; i++) {
+		connections[i].idx = i;
+		connections[i].state = CONN_CLOSED;
+		free_slots[i] = per_thread_conn - i - 1;
+	}
+	free_count = per_thread_conn;
+	return 0;
+}
+
+static void churn_close(struct tcp_connection *conn)
+{
+	close(conn->fd);
+	conn->state = CONN_CLOSED;
+	free_slots[free_count++] = conn->idx;
+}
+
+static int churn_connect(struct tcp_connection *conn, struct host_tuple *target)
+{
+	struct linger linger;
+	int sock, one = 1;
+
+	slots[conn->idx].start = time_ns();
+	sock = nb_connect(target, epoll_fd, conn->idx);
+	if (sock < 0)
+		return -1;
+
+	/* Disable Nagle */
+	if (target_is_inet(target))
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	/* Close with RST, so that the churn doesn't run out of ports */
+	linger.l_onoff = 1;
+	linger.l_linger = 0;
+	setsockopt(sock, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+
+	conn->fd = sock;
+	conn->pending_reqs = 0;
+	conn->rx_head = 0;
+	conn->rx_tail = 0;
+	conn->state = CONN_OPEN;
+	return 0;
+}
+
+/*
+ * The connection is established or failed, send the request
+ */
+static void churn_connected(struct tcp_connection *conn)
+{
+	struct epoll_event event;
+	struct request *to_send;
+	struct byte_req_pair send_res;
+	int i, ret, bytes_to_send, error = 0;
+	socklen_t errlen = sizeof(error);
+
+	if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &errlen) || error) {
+		add_connect_error();
+		churn_close(conn);
+		return;
+	}
+	add_connect_sample(time_ns() - slots[conn->idx].start);
+
+	to_send = conn_request(conn, PROTO_NR);
+	bytes_to_send = 0;
+	for (i=0;i<to_send->iov_cnt;i++)
+		bytes_to_send += to_send->iovs[i].iov_len;
+	time_ns_to_ts(&slots[conn->idx].tx);
+	ret = writev(conn->fd, to_send->iovs, to_send->iov_cnt);
+	if (ret != bytes_to_send) {
+		add_request_error();
+		churn_close(conn);
+		return;
+	}
+	conn->pending_reqs = 1;
+
+	event.events = EPOLLIN;
+	event.data.u32 = conn->idx;
+	ret = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+	assert(ret == 0);
+
+	/*BookKeeping*/
+	send_res.bytes = bytes_to_send;
+	send_res.reqs = 1;
+	add_throughput_tx_sample(send_res);
+}
+
+static void churn_response(struct tcp_connection *conn)
+{
+	struct byte_req_pair read_res;
+	struct timespec *tx;
+	long rx;
+	int ret;
+
+	ret = conn_recv(conn, &read_res, NULL);
+	if ((ret < 0) && (errno == EWOULDBLOCK))
+		return;
+	if (ret <= 0) {
+		add_request_error();
+		churn_close(conn);
+		return;
+	}
+	if (read_res.reqs == 0)
+		return;
+
+	rx = time_ns();
+	tx = &slots[conn->idx].tx;
+	/*BookKeeping*/
+	add_throughput_rx_sample(read_res);
+	add_latency_sample(rx - (tx->tv_sec * 1000000000L + tx->tv_nsec), tx,
+			conn_id(conn), conn->target);
+	churn_close(conn);
+}
+
+static void connect_tcp_main(void)
+{
+	int ready, idx, i, conn_per_thread, next_target;
+	long next_tx, now;
+	struct epoll_event *events;
+	struct tcp_connection *conn;
+	struct host_tuple *targets;
+
+	kernel_init(&kernel);
+	if (connect_init())
+		return;
+
+	/*Initializations*/
+	conn_per_thread = thread_conns;
+	events = malloc(conn_per_thread * sizeof(struct epoll_event));
+	targets = get_targets();
+	next_target = get_agent_tid() % get_target_count();
+
+	next_tx = time_ns();
+	while (1) {
+		if (!should_load()) {
+			idle_wait();
+			next_tx = time_ns();
+			continue;
+		}
+		loop_begin();
+		now = time_ns();
+		if ((now >= next_tx) && !free_count)
+			loop_window_full();
+		if (free_count && (now >= next_tx)) {
+			loop_sent(now - next_tx);
+			conn = &connections[free_slots[--free_count]];
+			conn->target = next_target;
+			next_target = (next_target + 1) % get_target_count();
+			if (churn_connect(conn, &targets[conn->target])) {
+				add_connect_error();
+				free_slots[free_count++] = conn->idx;
+			}
+
+			/*Schedule next*/
+			next_tx = get_next_tx(next_tx);
+		}
+
+		ready = epoll_wait(epoll_fd, events, conn_per_thread, 0);
+		loop_polled(ready);
+		for (i = 0; i < ready; i++) {
+			idx = events[i].data.u32;
+			conn = &connections[idx];
+			if (conn->state != CONN_OPEN)
+				continue;
+			if (conn->pending_reqs == 0)
+				churn_connected(conn);
+			else
+				churn_response(conn);
+		}
+		loop_end();
+	}
+}
+
 struct transport_protocol *init_tcp(void)
 {
 	struct transport_protocol *tp;
@@ -694,7 +1384,9 @@ struct transport_protocol *init_tcp(void)
 	tp->tp_main[THROUGHPUT_AGENT] = throughput_tcp_main;
 	tp->tp_main[LATENCY_AGENT] = latency_tcp_main;
 	tp->tp_main[SYMMETRIC_NIC_TIMESTAMP_AGENT] = symmetric_nic_tcp_main;
+	tp->tp_main[SYMMETRIC_SW_TIMESTAMP_AGENT] = symmetric_nic_tcp_main;
 	tp->tp_main[SYMMETRIC_AGENT] = symmetric_tcp_main;
+	tp->tp_main[CONNECT_AGENT] = connect_tcp_main;
 
 	return tp;
 }
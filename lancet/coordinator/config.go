@@ -26,40 +26,57 @@ package main
 
 import (
 	"flag"
+	"fmt"
+	"os"
 	"strings"
 )
 
 type ServerConfig struct {
-	target    string
-	thThreads int
-	ltThreads int
-	thConn    int
-	ltConn    int
-	idist     string
-	appProto  string
-	comProto  string
-	keyCount  int
+	target     string
+	thThreads  int
+	ltThreads  int
+	thConn     int
+	ltConn     int
+	idist      string
+	appProto   string
+	comProto   string
+	keyCount   int
+	connPolicy string
+	placement  string
 }
 
 type ExperimentConfig struct {
-	thAgents    []string
-	ltAgents    []string
-	symAgents   []string
-	agentPort   int
-	thBinary    string
-	ltBinary    string
-	ltRate      int
-	loadPattern string
-	ciSize      int
-	nicTS       bool
+	thAgents     []string
+	ltAgents     []string
+	symAgents    []string
+	connAgents   []string
+	agentPort    int
+	thBinary     string
+	ltBinary     string
+	ltRate       int
+	loadPattern  string
+	ciSize       int
+	nicTS        bool
+	swTS         bool
+	tsIf         string
+	perTarget    bool
+	readyWait    int
+	maxLag       int
+	rejectSat    bool
+	perfCounters bool
+	warmupIntvl  int
+	maxWarmup    int
+	loadSched    string
+	tenants      []string
 }
 
 func ParseConfig() (*ServerConfig, *ExperimentConfig) {
 	var agentPort = flag.Int("agentPort", 5001, "listening port of the agent")
-	var target = flag.String("targetHost", "127.0.0.1:8000", "host:port comma-separated list to run experiment against")
+	var target = flag.String("targetHost", "127.0.0.1:8000", "comma-separated list of host:port[@source], unix:path, unixpacket:path or vsock:cid:port to run experiment against")
 	var thAgents = flag.String("loadAgents", "", "ip of loading agents separated by commas, e.g. ip1,ip2,...")
 	var ltAgents = flag.String("ltAgents", "", "ip of latency agents separated by commas, e.g. ip1,ip2,...")
 	var symAgents = flag.String("symAgents", "", "ip of latency agents separated by commas, e.g. ip1,ip2,...")
+	var connAgents = flag.String("connAgents", "", "ip of connection churn agents separated by commas, e.g. ip1,ip2,...")
 	var thBinary = flag.String("loadBinary", "", "path of the load agent binary")
 	var ltBinary = flag.String("ltBinary", "", "path of the latency agent binary")
 	var thThreads = flag.Int("loadThreads", 16, "loading threads per agent")
@@ -69,11 +86,24 @@ func ParseConfig() (*ServerConfig, *ExperimentConfig) {
 	var idist = flag.String("idist", "exp", "interarrival distibution: fixed, exp")
 	var appProto = flag.String("appProto", "bmc_fixed:19_fixed:2_1000000_0.998", "application proto: echo:<#bytes>, bmc_<key_gen>_<val_gen>_<key_count>_<rw_ratio>, synthetic:<rand_gen>:<avg>")
 	var comProto = flag.String("comProto", "TCP", "TCP|R2P2")
+	var connPolicy = flag.String("connPolicy", "random", "connection selection: random|rr|least|weighted:<w0>,<w1>,..., only random with -tenants")
+	var placement = flag.String("placement", "seq", "agent thread placement: seq|core|nic|list:<cpulist>, nic needs -tsIf")
 	var ltRate = flag.Int("lqps", 16000, "throughput qps")
-	var loadPattern = flag.String("loadPattern", "step:10000:100000:50000", "load pattern fixed:load|step:start:end:step")
+	var loadPattern = flag.String("loadPattern", "step:10000:100000:50000", "load pattern fixed:load|step:start:end:step|connect:rate")
 	var ciSize = flag.Int("ciSize", 5, "size of 95-confidence interval in us")
 	var keyCount = flag.Int("keyCount", 100000, "number of keys if appProto bmc")
 	var nicTS = flag.Bool("nicTS", false, "NIC timestamping for symmetric agents")
+	var swTS = flag.Bool("swTS", false, "kernel software timestamping for symmetric agents")
+	var tsIf = flag.String("tsIf", "", "interface the agents timestamp on and place their threads near, required with -nicTS")
+	var perTarget = flag.Bool("perTarget", false, "report the latency of every target")
+	var readyWait = flag.Int("readyWait", 0, "seconds to wait for all the agent connections before starting, 0 to not wait")
+	var maxLag = flag.Int("maxLag", 50, "99th percentile send lag behind the schedule in us above which an agent is the bottleneck")
+	var warmupIntvl = flag.Int("warmupInterval", 250, "ms between the throughput and latency polls of the steady state detection")
+	var maxWarmup = flag.Int("maxWarmup", 60, "seconds to wait for a steady state before measuring anyway")
+	var loadSched = flag.String("loadSchedule", "", "load schedule of the agents over the load rate, e.g. ramp:0.1:1:30, see inc/lancet/load_sched.h")
+	var tenants = flag.String("tenants", "", "space separated tenants of the load agents, <targets>/<rate>[/<proto>[/<idist>[/<schedule>]]], e.g. \"0-3/9 4/1\", needs -connPolicy random")
+	var perfCounters = flag.Bool("perfCounters", false, "report the agent hardware counters per request")
+	var rejectSat = flag.Bool("rejectSaturated", false, "retry or fail the measurements where an agent was the bottleneck instead of only flagging them")
 
 	flag.Parse()
 
@@ -89,6 +119,8 @@ func ParseConfig() (*ServerConfig, *ExperimentConfig) {
 	serverCfg.appProto = *appProto
 	serverCfg.comProto = *comProto
 	serverCfg.keyCount = *keyCount
+	serverCfg.connPolicy = *connPolicy
+	serverCfg.placement = *placement
 
 	if *thAgents == "" {
 		expCfg.thAgents = nil
@@ -105,6 +137,11 @@ func ParseConfig() (*ServerConfig, *ExperimentConfig) {
 	} else {
 		expCfg.symAgents = strings.Split(*symAgents, ",")
 	}
+	if *connAgents == "" {
+		expCfg.connAgents = nil
+	} else {
+		expCfg.connAgents = strings.Split(*connAgents, ",")
+	}
 	expCfg.agentPort = *agentPort
 	expCfg.thBinary = *thBinary
 	expCfg.ltBinary = *ltBinary
@@ -112,6 +149,25 @@ func ParseConfig() (*ServerConfig, *ExperimentConfig) {
 	expCfg.loadPattern = *loadPattern
 	expCfg.ciSize = *ciSize
 	expCfg.nicTS = *nicTS
+	expCfg.swTS = *swTS
+	expCfg.tsIf = *tsIf
+	if expCfg.nicTS && expCfg.tsIf == "" {
+		fmt.Println("NIC timestamping needs the interface, use -tsIf")
+		os.Exit(1)
+	}
+	expCfg.perTarget = *perTarget
+	expCfg.readyWait = *readyWait
+	expCfg.maxLag = *maxLag
+	expCfg.rejectSat = *rejectSat
+	expCfg.perfCounters = *perfCounters
+	expCfg.warmupIntvl = *warmupIntvl
+	expCfg.maxWarmup = *maxWarmup
+	expCfg.loadSched = *loadSched
+	expCfg.tenants = strings.Fields(*tenants)
+	if len(expCfg.tenants) > 0 && serverCfg.connPolicy != "random" {
+		fmt.Println("Tenants pick their connections at random, use -connPolicy random")
+		os.Exit(1)
+	}
 
 	return serverCfg, expCfg
 }
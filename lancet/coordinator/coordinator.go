@@ -38,10 +38,18 @@ type coordinator struct {
 	thAgents     []*agent
 	ltAgents     []*agent
 	symAgents    []*agent
+	connAgents   []*agent
 	agentPort    int
 	samples      int
 	state        coordState
 	samplingRate float64
+	perTarget    bool
+	maxLag       int
+	rejectSat    bool
+	perfCounters bool
+	warmupIntvl  int
+	maxWarmup    int
+	loadSched    string
 }
 
 const (
@@ -54,6 +62,60 @@ const (
 	exit                coordState = 2
 )
 
+// Check the agent loop telemetry of the last measurement window for
+// threads that could not keep up with their schedule. Sends that waited
+// for a connection below max_pending are the server's, not the agent's.
+func (c *coordinator) clientBottleneck(agents []*agent) (bool, error) {
+	telemetry, err := reportTelemetry(agents)
+	if err != nil {
+		return false, fmt.Errorf("Error getting telemetry replies: %v\n", err)
+	}
+	printTelemetry(telemetry)
+
+	bottleneck := false
+	for i, s := range telemetry {
+		for _, t := range s.threads {
+			reasons := make([]string, 0)
+			if int(t.Lag_p99) > c.maxLag*1000 {
+				reasons = append(reasons, fmt.Sprintf("99th lag %vus",
+					float64(t.Lag_p99)/1e3))
+			}
+			if t.Iterations > 0 && 20*t.Idle_iterations < t.Iterations {
+				reasons = append(reasons, fmt.Sprintf("%v/%v idle iterations",
+					t.Idle_iterations, t.Iterations))
+			}
+			if 100*t.Pick_failures > t.Sends {
+				reasons = append(reasons, fmt.Sprintf("%v/%v pick failures",
+					t.Pick_failures, t.Sends))
+			}
+			if 100*t.Window_full > t.Sends {
+				fmt.Printf("Agent %v thread %v: the server is saturated, "+
+					"%v/%v sends waited for a connection below max pending\n",
+					i, t.Thread, t.Window_full, t.Sends)
+			}
+			if len(reasons) > 0 {
+				fmt.Printf("Agent %v thread %v is the bottleneck: %v\n",
+					i, t.Thread, strings.Join(reasons, ", "))
+				bottleneck = true
+			}
+		}
+	}
+	return bottleneck, nil
+}
+
+// Print the agent CPU cost per request of the last measurement window
+func (c *coordinator) reportCosts(agents []*agent) error {
+	if !c.perfCounters {
+		return nil
+	}
+	counters, err := reportCounters(agents)
+	if err != nil {
+		return fmt.Errorf("Error getting counter replies: %v\n", err)
+	}
+	printCounters(counters)
+	return nil
+}
+
 func (c *coordinator) testAsymPattern(loadRate, latencyRate int) error {
 	// Start loading
 	var err error
@@ -68,8 +130,12 @@ func (c *coordinator) testAsymPattern(loadRate, latencyRate int) error {
 		return fmt.Errorf("Error setting load: %v\n", err)
 	}
 
-	// Wait
-	time.Sleep(10 * time.Second)
+	// Wait for the warm-up
+	loadAgents := append(append([]*agent{}, c.thAgents...), c.ltAgents...)
+	err = c.waitSteady(loadAgents)
+	if err != nil {
+		return err
+	}
 
 	// Measure
 	var latSamplingRate float64
@@ -87,7 +153,10 @@ func (c *coordinator) testAsymPattern(loadRate, latencyRate int) error {
 	// Wait for experiment to run
 	duration := int(math.Ceil(float64(c.samples) / (float64(latencyRate) * (float64(latSamplingRate) / 100.0))))
 	fmt.Printf("Will run for %v sec\n", duration)
-	time.Sleep(time.Duration(duration) * time.Second)
+	err = c.waitMeasure(loadAgents, duration)
+	if err != nil {
+		return err
+	}
 
 	throughputReplies, iaComp, e2 := reportThroughput(c.thAgents)
 	if e2 != nil {
@@ -99,6 +168,26 @@ func (c *coordinator) testAsymPattern(loadRate, latencyRate int) error {
 		return fmt.Errorf("Error getting latency replies: %v\n", e3)
 	}
 
+	var targetReplies []*targetStats
+	if c.perTarget {
+		targetReplies, e3 = reportTargets(c.ltAgents)
+		if e3 != nil {
+			return fmt.Errorf("Error getting target replies: %v\n", e3)
+		}
+	}
+
+	bottleneck, e4 := c.clientBottleneck(append(c.thAgents, c.ltAgents...))
+	if e4 != nil {
+		return e4
+	}
+	e4 = c.reportCosts(append(c.thAgents, c.ltAgents...))
+	if e4 != nil {
+		return e4
+	}
+	if bottleneck && c.rejectSat {
+		return fmt.Errorf("Measurement rejected: the agents were the bottleneck\n")
+	}
+
 	// Report results
 	for _, reply := range latencyReplies {
 		latAgentThroughput := &reply.Th_data
@@ -110,6 +199,9 @@ func (c *coordinator) testAsymPattern(loadRate, latencyRate int) error {
 	fmt.Printf("Check inter-arrival: %v\n", iaComp)
 
 	computeStatsLatency(latencyReplies)
+	if c.perTarget {
+		printTargetStats(targetReplies)
+	}
 
 	return nil
 }
@@ -122,8 +214,11 @@ func (c *coordinator) testSymPattern(loadRate int) error {
 		return fmt.Errorf("Error setting load: %v\n", err)
 	}
 
-	// Wait
-	time.Sleep(5 * time.Second)
+	// Wait for the warm-up
+	err = c.waitSteady(c.symAgents)
+	if err != nil {
+		return err
+	}
 	fmt.Printf("The sampling rate is %v\n", c.samplingRate)
 	perAgentSampingRate := c.samplingRate //float64(len(c.symAgents)) * c.samplingRate
 	fmt.Printf("Per agent sampling rate %v\n", perAgentSampingRate)
@@ -137,13 +232,36 @@ func (c *coordinator) testSymPattern(loadRate int) error {
 	sps := (float64(perAgentLoad) * float64(perAgentSampingRate)) / 100.0
 	duration := int(math.Ceil(float64(c.samples) / sps))
 	fmt.Printf("Will run for %v sec\n", duration)
-	time.Sleep(time.Duration(duration) * time.Second)
+	err = c.waitMeasure(c.symAgents, duration)
+	if err != nil {
+		return err
+	}
 
 	latencyReplies, iaComp, convergence, correlations, e2 := reportLatency(c.symAgents)
 	if e2 != nil {
 		return fmt.Errorf("Error getting latency replies: %v\n", e2)
 	}
 
+	var targetReplies []*targetStats
+	if c.perTarget {
+		targetReplies, e2 = reportTargets(c.symAgents)
+		if e2 != nil {
+			return fmt.Errorf("Error getting target replies: %v\n", e2)
+		}
+	}
+
+	bottleneck, e3 := c.clientBottleneck(c.symAgents)
+	if e3 != nil {
+		return e3
+	}
+	e3 = c.reportCosts(c.symAgents)
+	if e3 != nil {
+		return e3
+	}
+	if bottleneck && c.rejectSat {
+		return fmt.Errorf("Measurement rejected: the agents were the bottleneck\n")
+	}
+
 	// Report results
 	throughputReplies := make([]*C.struct_throughput_reply, 0)
 	for _, reply := range latencyReplies {
@@ -162,6 +280,9 @@ func (c *coordinator) testSymPattern(loadRate int) error {
 	fmt.Printf("Result convergence: %v\n", convergence)
 	fmt.Printf("Correlations for iidness: %v\n", correlations)
 	fmt.Printf("IA Compliance?: %v\n", iaComp)
+	if c.perTarget {
+		printTargetStats(targetReplies)
+	}
 
 	return nil
 }
@@ -176,8 +297,11 @@ func (c *coordinator) fixedSymPattern(loadRate, ciSize int) error {
 	}
 	c.state = waitForThroughput
 
-	// Wait
-	time.Sleep(2 * time.Second)
+	// Wait for the warm-up
+	err = c.waitSteady(c.symAgents)
+	if err != nil {
+		return err
+	}
 	tryCount := 0
 	expectedRPS := float64(loadRate)
 	for tryCount < maxTries {
@@ -189,6 +313,11 @@ func (c *coordinator) fixedSymPattern(loadRate, ciSize int) error {
 			}
 
 			fmt.Println("Trying throughput")
+			// Drop the interval of the warm-up
+			_, err = reportInterval(c.symAgents)
+			if err != nil {
+				return fmt.Errorf("Error getting interval replies: %v\n", err)
+			}
 			// Wait
 			time.Sleep(1 * time.Second)
 			// Collect throughput
@@ -198,6 +327,14 @@ func (c *coordinator) fixedSymPattern(loadRate, ciSize int) error {
 			}
 			aggThroughput := computeStatsThroughput(throughputReplies)
 			rps := getRPS(aggThroughput)
+			// A schedule moves the rate, check it against the offered one
+			if c.loadSched != "" {
+				intervals, e3 := reportInterval(c.symAgents)
+				if e3 != nil {
+					return fmt.Errorf("Error getting interval replies: %v\n", e3)
+				}
+				expectedRPS = c.scheduledOffered(c.symAgents, intervals)
+			}
 			fmt.Println(rps)
 			fmt.Printf("Throughput should be between %v %v\n", 0.9*expectedRPS, 1.1*expectedRPS)
 
@@ -239,7 +376,10 @@ func (c *coordinator) fixedSymPattern(loadRate, ciSize int) error {
 			fmt.Printf("Will run for %v sec\n", duration)
 			fmt.Printf("Sampling rate = %v\n", c.samplingRate)
 			fmt.Printf("Number of samples = %v\n", c.samples)
-			time.Sleep(time.Duration(duration) * time.Second)
+			err = c.waitMeasure(c.symAgents, duration)
+			if err != nil {
+				return err
+			}
 
 			latencyReplies, iaComp, convergence, correlations, e2 := reportLatency(c.symAgents)
 			if e2 != nil {
@@ -248,6 +388,20 @@ func (c *coordinator) fixedSymPattern(loadRate, ciSize int) error {
 
 			fmt.Printf("Unhandled IA comp: %v\n", iaComp)
 
+			// Check the agents kept up with the schedule
+			bottleneck, e3 := c.clientBottleneck(c.symAgents)
+			if e3 != nil {
+				return e3
+			}
+			e3 = c.reportCosts(c.symAgents)
+			if e3 != nil {
+				return e3
+			}
+			if bottleneck && c.rejectSat {
+				tryCount += 1
+				continue
+			}
+
 			// Check correlations
 			fmt.Printf("Correlations for iidness: %v\n", correlations)
 			notOk := false
@@ -302,6 +456,14 @@ func (c *coordinator) fixedSymPattern(loadRate, ciSize int) error {
 			fmt.Println("Aggregate latency")
 			printLatencyStats(agg_lat)
 
+			if c.perTarget {
+				targetReplies, e3 := reportTargets(c.symAgents)
+				if e3 != nil {
+					return fmt.Errorf("Error getting target replies: %v\n", e3)
+				}
+				printTargetStats(targetReplies)
+			}
+
 			c.state = exit
 		case exit:
 			return nil
@@ -312,6 +474,101 @@ func (c *coordinator) fixedSymPattern(loadRate, ciSize int) error {
 	return fmt.Errorf("Exp Failure: Max tries reached\n")
 }
 
+func (c *coordinator) connectPattern(connRate int) error {
+	err := startLoad(c.connAgents, int(connRate/len(c.connAgents)))
+	if err != nil {
+		return fmt.Errorf("Error setting load: %v\n", err)
+	}
+
+	// Wait for the warm-up
+	err = c.waitSteady(c.connAgents)
+	if err != nil {
+		return err
+	}
+
+	err = startMeasure(c.connAgents, c.samples, 100)
+	if err != nil {
+		return fmt.Errorf("Error starting load: %v\n", err)
+	}
+
+	// Wait for experiment to run
+	duration := int(math.Ceil(float64(c.samples) / float64(connRate)))
+	fmt.Printf("Will run for %v sec\n", duration)
+	err = c.waitMeasure(c.connAgents, duration)
+	if err != nil {
+		return err
+	}
+
+	latencyReplies, _, _, _, e2 := reportLatency(c.connAgents)
+	if e2 != nil {
+		return fmt.Errorf("Error getting latency replies: %v\n", e2)
+	}
+	connectReplies, e3 := reportConnect(c.connAgents)
+	if e3 != nil {
+		return fmt.Errorf("Error getting connect replies: %v\n", e3)
+	}
+
+	bottleneck, e4 := c.clientBottleneck(c.connAgents)
+	if e4 != nil {
+		return e4
+	}
+	e4 = c.reportCosts(c.connAgents)
+	if e4 != nil {
+		return e4
+	}
+	if bottleneck && c.rejectSat {
+		return fmt.Errorf("Measurement rejected: the agents were the bottleneck\n")
+	}
+
+	// Report results
+	throughputReplies := make([]*C.struct_throughput_reply, 0)
+	for _, reply := range latencyReplies {
+		latAgentThroughput := &reply.Th_data
+		throughputReplies = append(throughputReplies, latAgentThroughput)
+	}
+	agg_throughput := computeStatsThroughput(throughputReplies)
+	fmt.Println("Connection churn")
+	printThroughputStats(agg_throughput)
+
+	fmt.Println("Request latency")
+	computeStatsLatency(latencyReplies)
+
+	fmt.Println("Connect latency")
+	printConnectStats(connectReplies)
+
+	return nil
+}
+
+// Poll the agents until all their connections are established. The
+// connection churn agents don't keep connections open, so they are
+// never ready and are left out.
+func (c *coordinator) waitReady(timeout int) error {
+	agents := append(append(append([]*agent{}, c.thAgents...),
+		c.ltAgents...), c.symAgents...)
+	deadline := time.Now().Add(time.Duration(timeout) * time.Second)
+	for {
+		readiness, err := reportReadiness(agents)
+		if err != nil {
+			return fmt.Errorf("Error getting readiness replies: %v\n", err)
+		}
+		ready := true
+		for _, r := range readiness {
+			if r.hdr.Ready_targets < r.hdr.Target_count {
+				ready = false
+			}
+		}
+		if ready {
+			printReadiness(readiness)
+			return nil
+		}
+		if time.Now().After(deadline) {
+			printReadiness(readiness)
+			return fmt.Errorf("Targets not ready after %v sec\n", timeout)
+		}
+		time.Sleep(time.Second)
+	}
+}
+
 func (c *coordinator) stepPattern(startLoad, endLoad, step, latencyRate, ciSize int) error {
 	loadRate := startLoad
 	for loadRate < endLoad {
@@ -340,6 +597,15 @@ func (c *coordinator) runExp(pattern string, latencyRate, ciSize int) error {
 			return fmt.Errorf("Error parsing load\n")
 		}
 		return c.fixedSymPattern(loadRate, ciSize)
+	} else if patternAgs[0] == "connect" {
+		if len(c.connAgents) == 0 {
+			return fmt.Errorf("Connect only supported with connection agents\n")
+		}
+		connRate, err := strconv.Atoi(patternAgs[1])
+		if err != nil {
+			return fmt.Errorf("Error parsing load\n")
+		}
+		return c.connectPattern(connRate)
 	} else if patternAgs[0] == "step" {
 		var step, endLoad int
 		startLoad, err := strconv.Atoi(patternAgs[1])
@@ -38,6 +38,7 @@ import (
 const (
 	tROUGHPUT_AGENT = iota
 	lATENCY_AGENT
+	cONNECT_AGENT
 )
 
 type agent struct {
@@ -61,7 +62,17 @@ func main() {
 	if expCfg.symAgents != nil {
 		c.symAgents = make([]*agent, len(expCfg.symAgents))
 	}
+	if expCfg.connAgents != nil {
+		c.connAgents = make([]*agent, len(expCfg.connAgents))
+	}
 	c.agentPort = expCfg.agentPort
+	c.perTarget = expCfg.perTarget
+	c.maxLag = expCfg.maxLag
+	c.rejectSat = expCfg.rejectSat
+	c.perfCounters = expCfg.perfCounters
+	c.warmupIntvl = expCfg.warmupIntvl
+	c.maxWarmup = expCfg.maxWarmup
+	c.loadSched = expCfg.loadSched
 
         /*// Start server with micro VMs
         s := strings.Split(serverCfg.target, ":")
@@ -78,10 +89,30 @@ func main() {
         time.Sleep(20 * time.Second)
         */
 
+	// Options shared by all the agents
+	commonArgs := fmt.Sprintf("-C %s", serverCfg.placement)
+	if expCfg.tsIf != "" {
+		commonArgs += fmt.Sprintf(" -n %s", expCfg.tsIf)
+	}
+	if expCfg.perfCounters {
+		commonArgs += " -P"
+	}
+	// The latency agents keep probing at a constant rate
+	loadArgs := commonArgs
+	if expCfg.loadSched != "" {
+		loadArgs += fmt.Sprintf(" -L %s", expCfg.loadSched)
+	}
+	// Tenants need open-loop agents, the churn agents don't take them
+	tenantArgs := loadArgs
+	for _, t := range expCfg.tenants {
+		tenantArgs += fmt.Sprintf(" -T %s", t)
+	}
+
         // Deploy throughput agents
-	agentArgs := fmt.Sprintf("-s %s -t %d -c %d -i %s -p %s -r %s -a 0",
+	agentArgs := fmt.Sprintf("-s %s -t %d -c %d -i %s -p %s -r %s -b %s %s -a 0",
 		serverCfg.target, serverCfg.thThreads, serverCfg.thConn,
-		serverCfg.idist, serverCfg.comProto, serverCfg.appProto)
+		serverCfg.idist, serverCfg.comProto, serverCfg.appProto,
+		serverCfg.connPolicy, tenantArgs)
 
 	for i, a := range expCfg.thAgents {
 		session, err := deployAgent(a, expCfg.thBinary, agentArgs)
@@ -94,9 +125,10 @@ func main() {
 	}
 
 	// Deploy latency agents
-	ltArgs := fmt.Sprintf("-s %s -t %d -c %d -i %s -p %s -r %s -a 1",
+	ltArgs := fmt.Sprintf("-s %s -t %d -c %d -i %s -p %s -r %s -b %s %s -a 1",
 		serverCfg.target, serverCfg.ltThreads, serverCfg.ltConn,
-		serverCfg.idist, serverCfg.comProto, serverCfg.appProto)
+		serverCfg.idist, serverCfg.comProto, serverCfg.appProto,
+		serverCfg.connPolicy, commonArgs)
 	for i, a := range expCfg.ltAgents {
 		session, err := deployAgent(a, expCfg.ltBinary, ltArgs)
 		if err != nil {
@@ -111,13 +143,17 @@ func main() {
 	if expCfg.nicTS {
 		fmt.Println("NIC timestamping")
 		symType = 2
+	} else if expCfg.swTS {
+		fmt.Println("Kernel software timestamping")
+		symType = 5
 	} else {
 		fmt.Println("Userspace timestamping")
 		symType = 3
 	}
-	symArgs := fmt.Sprintf("-s %s -t %d -c %d -i %s -p %s -r %s -a %d",
+	symArgs := fmt.Sprintf("-s %s -t %d -c %d -i %s -p %s -r %s -b %s %s -a %d",
 		serverCfg.target, serverCfg.thThreads, serverCfg.thConn,
-		serverCfg.idist, serverCfg.comProto, serverCfg.appProto, symType)
+		serverCfg.idist, serverCfg.comProto, serverCfg.appProto,
+		serverCfg.connPolicy, tenantArgs, symType)
 	for i, a := range expCfg.symAgents {
 		session, err := deployAgent(a, expCfg.thBinary, symArgs)
 		if err != nil {
@@ -128,6 +164,21 @@ func main() {
 		c.symAgents[i] = &agent{name: a, aType: lATENCY_AGENT}
 	}
 
+	// Deploy connection churn agents
+	connArgs := fmt.Sprintf("-s %s -t %d -c %d -i %s -p %s -r %s %s -a 4",
+		serverCfg.target, serverCfg.ltThreads, serverCfg.ltConn,
+		serverCfg.idist, serverCfg.comProto, serverCfg.appProto,
+		loadArgs)
+	for i, a := range expCfg.connAgents {
+		session, err := deployAgent(a, expCfg.ltBinary, connArgs)
+		if err != nil {
+			fmt.Println(err)
+			os.Exit(1)
+		}
+		defer session.Close()
+		c.connAgents[i] = &agent{name: a, aType: cONNECT_AGENT}
+	}
+
 	time.Sleep(5000 * time.Millisecond)
 
 	// Initialize management connections
@@ -180,6 +231,31 @@ func main() {
 		a.conn = conn
 	}
 
+	for _, a := range c.connAgents {
+		tcpAddr, err := net.ResolveTCPAddr("tcp", fmt.Sprintf("%s:%d", a.name, c.agentPort))
+		if err != nil {
+			fmt.Println("ResolveTCPAddr failed:", err)
+			os.Exit(1)
+
+		}
+		conn, err := net.DialTCP("tcp", nil, tcpAddr)
+		if err != nil {
+			fmt.Println("Dial failed:", err)
+			os.Exit(1)
+
+		}
+		defer conn.Close()
+		a.conn = conn
+	}
+
+	if expCfg.readyWait > 0 {
+		err := c.waitReady(expCfg.readyWait)
+		if err != nil {
+			fmt.Println(err)
+			os.Exit(1)
+		}
+	}
+
 	// Run experiment
 	err := c.runExp(expCfg.loadPattern, expCfg.ltRate, expCfg.ciSize)
 	if err != nil {
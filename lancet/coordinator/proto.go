@@ -30,6 +30,7 @@ import (
 	"bytes"
 	"encoding/binary"
 	"fmt"
+	"io"
 	"time"
 	/*
 		"strings"
@@ -185,6 +186,155 @@ func collectLatencyResults(agents []*agent) ([]*C.struct_latency_reply, []uint32
 	return result, iaComp, convergence, correlations, nil
 }
 
+// Read the reply of every agent, which must be of replyType, and hand its
+// payload to parse
+func collect(agents []*agent, replyType C.uint32_t,
+	parse func(r *bytes.Reader) error) error {
+	timeOut := 5000 * time.Millisecond
+	for _, a := range agents {
+		a.conn.SetReadDeadline(time.Now().Add(timeOut))
+		prelude := &C.struct_msg1{}
+		err := binary.Read(a.conn, binary.LittleEndian, prelude)
+		if err != nil {
+			return fmt.Errorf("Read from agent failed: %v\n", err)
+		}
+		if prelude.Info != replyType {
+			return fmt.Errorf("Didn't receive reply %v but %v\n", replyType,
+				prelude.Info)
+		}
+		// The payload size depends on the number of entries
+		data := make([]byte, int(prelude.Hdr.MessageLength)-4)
+		_, err = io.ReadFull(a.conn, data)
+		if err != nil {
+			return fmt.Errorf("Read from agent failed: %v\n", err)
+		}
+		err = parse(bytes.NewReader(data))
+		if err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+type targetStats struct {
+	hdr     *C.struct_target_reply_hdr
+	targets []*C.struct_target_reply
+}
+
+func parseTargets(r *bytes.Reader) (*targetStats, error) {
+	stats := &targetStats{hdr: &C.struct_target_reply_hdr{}}
+	err := binary.Read(r, binary.LittleEndian, stats.hdr)
+	if err != nil {
+		return nil, fmt.Errorf("Error parsing target_reply header: %v\n", err)
+	}
+	for i := 0; i < int(stats.hdr.Target_count); i++ {
+		reply := &C.struct_target_reply{}
+		err = binary.Read(r, binary.LittleEndian, reply)
+		if err != nil {
+			return nil, fmt.Errorf("Error parsing target_reply: %v\n", err)
+		}
+		stats.targets = append(stats.targets, reply)
+	}
+	return stats, nil
+}
+
+type connectStats struct {
+	summary *C.struct_connect_reply
+	buckets []*C.struct_hist_bucket_reply
+}
+
+func parseConnect(r *bytes.Reader) (*connectStats, error) {
+	stats := &connectStats{summary: &C.struct_connect_reply{}}
+	err := binary.Read(r, binary.LittleEndian, stats.summary)
+	if err != nil {
+		return nil, fmt.Errorf("Error parsing connect_reply: %v\n", err)
+	}
+	for i := 0; i < int(stats.summary.Bucket_count); i++ {
+		bucket := &C.struct_hist_bucket_reply{}
+		err = binary.Read(r, binary.LittleEndian, bucket)
+		if err != nil {
+			return nil, fmt.Errorf("Error parsing connect histogram: %v\n", err)
+		}
+		stats.buckets = append(stats.buckets, bucket)
+	}
+	return stats, nil
+}
+
+type readinessStats struct {
+	hdr     *C.struct_readiness_hdr
+	targets []*C.struct_target_readiness_reply
+}
+
+func parseReadiness(r *bytes.Reader) (*readinessStats, error) {
+	stats := &readinessStats{hdr: &C.struct_readiness_hdr{}}
+	err := binary.Read(r, binary.LittleEndian, stats.hdr)
+	if err != nil {
+		return nil, fmt.Errorf("Error parsing readiness header: %v\n", err)
+	}
+	for i := 0; i < int(stats.hdr.Target_count); i++ {
+		reply := &C.struct_target_readiness_reply{}
+		err = binary.Read(r, binary.LittleEndian, reply)
+		if err != nil {
+			return nil, fmt.Errorf("Error parsing readiness: %v\n", err)
+		}
+		stats.targets = append(stats.targets, reply)
+	}
+	return stats, nil
+}
+
+type telemetryStats struct {
+	hdr     *C.struct_telemetry_hdr
+	threads []*C.struct_thread_telemetry_reply
+}
+
+func parseTelemetry(r *bytes.Reader) (*telemetryStats, error) {
+	stats := &telemetryStats{hdr: &C.struct_telemetry_hdr{}}
+	err := binary.Read(r, binary.LittleEndian, stats.hdr)
+	if err != nil {
+		return nil, fmt.Errorf("Error parsing telemetry header: %v\n", err)
+	}
+	for i := 0; i < int(stats.hdr.Thread_count); i++ {
+		reply := &C.struct_thread_telemetry_reply{}
+		err = binary.Read(r, binary.LittleEndian, reply)
+		if err != nil {
+			return nil, fmt.Errorf("Error parsing telemetry: %v\n", err)
+		}
+		stats.threads = append(stats.threads, reply)
+	}
+	return stats, nil
+}
+
+type countersStats struct {
+	hdr     *C.struct_counters_hdr
+	threads []*C.struct_thread_counters_reply
+}
+
+func parseCounters(r *bytes.Reader) (*countersStats, error) {
+	stats := &countersStats{hdr: &C.struct_counters_hdr{}}
+	err := binary.Read(r, binary.LittleEndian, stats.hdr)
+	if err != nil {
+		return nil, fmt.Errorf("Error parsing counters header: %v\n", err)
+	}
+	for i := 0; i < int(stats.hdr.Thread_count); i++ {
+		reply := &C.struct_thread_counters_reply{}
+		err = binary.Read(r, binary.LittleEndian, reply)
+		if err != nil {
+			return nil, fmt.Errorf("Error parsing counters: %v\n", err)
+		}
+		stats.threads = append(stats.threads, reply)
+	}
+	return stats, nil
+}
+
+func parseInterval(r *bytes.Reader) (*C.struct_interval_reply, error) {
+	reply := &C.struct_interval_reply{}
+	err := binary.Read(r, binary.LittleEndian, reply)
+	if err != nil {
+		return nil, fmt.Errorf("Error parsing interval_reply: %v\n", err)
+	}
+	return reply, nil
+}
+
 func collectConvergenceResults(agents []*agent) ([]int, error) {
 	// Wait for ACK with a 2 second deadline
 	timeOut := 500 * time.Millisecond
@@ -311,3 +461,104 @@ func reportLatency(agents []*agent) ([]*C.struct_latency_reply, []uint32, []uint
 	}
 	return collectLatencyResults(agents)
 }
+
+// Ask the agents for a report of reportType, collect() reads the replies
+func report(agents []*agent, reportType C.uint32_t) error {
+	msg := C.struct_msg1{
+		Hdr: C.struct_msg_hdr{
+			MessageType:   C.uint32_t(C.REPORT_REQ),
+			MessageLength: C.uint32_t(4),
+		},
+		Info: reportType,
+	}
+	buf := &bytes.Buffer{}
+	err := binary.Write(buf, binary.LittleEndian, msg)
+	if err != nil {
+		return fmt.Errorf("Error formating message: %v", err)
+	}
+	return broadcastMessage(buf, agents)
+}
+
+func reportTargets(agents []*agent) ([]*targetStats, error) {
+	result := make([]*targetStats, 0)
+	err := report(agents, C.REPORT_TARGETS)
+	if err != nil {
+		return nil, err
+	}
+	err = collect(agents, C.REPLY_TARGET_STATS, func(r *bytes.Reader) error {
+		stats, err := parseTargets(r)
+		result = append(result, stats)
+		return err
+	})
+	return result, err
+}
+
+func reportConnect(agents []*agent) ([]*connectStats, error) {
+	result := make([]*connectStats, 0)
+	err := report(agents, C.REPORT_CONNECT)
+	if err != nil {
+		return nil, err
+	}
+	err = collect(agents, C.REPLY_CONNECT_STATS, func(r *bytes.Reader) error {
+		stats, err := parseConnect(r)
+		result = append(result, stats)
+		return err
+	})
+	return result, err
+}
+
+func reportReadiness(agents []*agent) ([]*readinessStats, error) {
+	result := make([]*readinessStats, 0)
+	err := report(agents, C.REPORT_READINESS)
+	if err != nil {
+		return nil, err
+	}
+	err = collect(agents, C.REPLY_READINESS, func(r *bytes.Reader) error {
+		stats, err := parseReadiness(r)
+		result = append(result, stats)
+		return err
+	})
+	return result, err
+}
+
+func reportTelemetry(agents []*agent) ([]*telemetryStats, error) {
+	result := make([]*telemetryStats, 0)
+	err := report(agents, C.REPORT_TELEMETRY)
+	if err != nil {
+		return nil, err
+	}
+	err = collect(agents, C.REPLY_TELEMETRY, func(r *bytes.Reader) error {
+		stats, err := parseTelemetry(r)
+		result = append(result, stats)
+		return err
+	})
+	return result, err
+}
+
+func reportCounters(agents []*agent) ([]*countersStats, error) {
+	result := make([]*countersStats, 0)
+	err := report(agents, C.REPORT_COUNTERS)
+	if err != nil {
+		return nil, err
+	}
+	err = collect(agents, C.REPLY_COUNTERS, func(r *bytes.Reader) error {
+		stats, err := parseCounters(r)
+		result = append(result, stats)
+		return err
+	})
+	return result, err
+}
+
+func reportInterval(agents []*agent) ([]*C.struct_interval_reply, error) {
+	result := make([]*C.struct_interval_reply, 0)
+	err := report(agents, C.REPORT_INTERVAL)
+	if err != nil {
+		return nil, err
+	}
+	err = collect(agents, C.REPLY_INTERVAL, func(r *bytes.Reader) error {
+		reply, err := parseInterval(r)
+		result = append(result, reply)
+		return err
+	})
+	return result, err
+}
@@ -36,6 +36,8 @@ func computeStatsThroughput(replies []*C.struct_throughput_reply) *C.struct_thro
 		agg_stats.Rx_bytes += r.Rx_bytes
 		agg_stats.Tx_bytes += r.Tx_bytes
 		agg_stats.Req_count += r.Req_count
+		agg_stats.Reconnects += r.Reconnects
+		agg_stats.Failed_sends += r.Failed_sends
 	}
 	agg_stats.Duration = replies[0].Duration
 
@@ -79,11 +81,12 @@ func computeStatsLatency(replies []*C.struct_latency_reply) *C.struct_latency_re
 }
 
 func printThroughputStats(stats *C.struct_throughput_reply) {
-	fmt.Println("#ReqCount\tQPS\tRxBw\tTxBw")
-	fmt.Printf("%v\t%v\t%v\t%v\n", stats.Req_count,
+	fmt.Println("#ReqCount\tQPS\tRxBw\tTxBw\tReconnects\tFailedSends")
+	fmt.Printf("%v\t%v\t%v\t%v\t%v\t%v\n", stats.Req_count,
 		1e6*float64(stats.Req_count)/float64(stats.Duration),
 		1e6*float64(stats.Rx_bytes)/float64(stats.Duration),
-		1e6*float64(stats.Tx_bytes)/float64(stats.Duration))
+		1e6*float64(stats.Tx_bytes)/float64(stats.Duration),
+		stats.Reconnects, stats.Failed_sends)
 }
 
 func printLatencyStats(stats *C.struct_latency_reply) {
@@ -96,6 +99,107 @@ func printLatencyStats(stats *C.struct_latency_reply) {
 		float64(stats.P99)/1e3, float64(stats.P99_i)/1e3, float64(stats.P99_k)/1e3)
 }
 
+func printTargetStats(stats []*targetStats) {
+	for i, s := range stats {
+		fmt.Printf("Agent %v per target latency\n", i)
+		fmt.Println("#Target\tReqCount\tAvg Lat\t50th\t90th\t99th")
+		for _, t := range s.targets {
+			fmt.Printf("%v\t%v\t%v\t%v\t%v\t%v\n", t.Target, t.Req_count,
+				float64(t.Avg_lat)/1e3, float64(t.P50)/1e3,
+				float64(t.P90)/1e3, float64(t.P99)/1e3)
+		}
+		fmt.Printf("Max/min 99th: %v/%v\n", float64(s.hdr.Max_p99)/1e3,
+			float64(s.hdr.Min_p99)/1e3)
+		fmt.Printf("Jain's index 99th: %v throughput: %v\n",
+			float64(s.hdr.Jain_p99), float64(s.hdr.Jain_throughput))
+	}
+}
+
+func printConnectStats(stats []*connectStats) {
+	for i, s := range stats {
+		fmt.Printf("Agent %v connect latency\n", i)
+		fmt.Println("#Connects\tConnect errors\tRequest errors\tConnects/s\tAvg Lat\t50th\t90th\t99th\t99.9th")
+		fmt.Printf("%v\t%v\t%v\t%v\t%v\t%v\t%v\t%v\t%v\n",
+			s.summary.Connects, s.summary.Connect_errors,
+			s.summary.Request_errors,
+			1e6*float64(s.summary.Connects)/float64(s.summary.Duration),
+			float64(s.summary.Avg_lat)/1e3, float64(s.summary.P50)/1e3,
+			float64(s.summary.P90)/1e3, float64(s.summary.P99)/1e3,
+			float64(s.summary.P999)/1e3)
+		fmt.Println("#Latency\tCount")
+		for _, b := range s.buckets {
+			fmt.Printf("%v\t%v\n", float64(b.Value)/1e3, b.Count)
+		}
+	}
+}
+
+func printReadiness(stats []*readinessStats) {
+	for i, s := range stats {
+		fmt.Printf("Agent %v: %v/%v targets ready after %v sec\n", i,
+			s.hdr.Ready_targets, s.hdr.Target_count,
+			float64(s.hdr.Elapsed)/1e9)
+		fmt.Println("#Target\tConns\tReady\tRetries\tFirst(s)\tAll(s)")
+		for _, t := range s.targets {
+			fmt.Printf("%v\t%v\t%v\t%v\t%v\t%v\n", t.Target, t.Conns,
+				t.Ready, t.Retries, float64(t.First_ready)/1e9,
+				float64(t.All_ready)/1e9)
+		}
+	}
+}
+
+func printTelemetry(stats []*telemetryStats) {
+	for i, s := range stats {
+		fmt.Printf("Agent %v loop telemetry over %v sec\n", i,
+			float64(s.hdr.Duration)/1e6)
+		fmt.Println("#Thread\tNode\tIterations\tIdle\tSends\tWakeups\tEvents\tPick failures\tWindow full\tAvg lag\t99th lag\t99.9th lag")
+		for _, t := range s.threads {
+			fmt.Printf("%v\t%v\t%v\t%v\t%v\t%v\t%v\t%v\t%v\t%v\t%v\t%v\n",
+				t.Thread, t.Node, t.Iterations, t.Idle_iterations,
+				t.Sends, t.Wakeups, t.Events, t.Pick_failures,
+				t.Window_full, float64(t.Lag_avg)/1e3, float64(t.Lag_p99)/1e3,
+				float64(t.Lag_p999)/1e3)
+		}
+	}
+}
+
+// Bits of counters_hdr.Available, in the order of inc/lancet/perf.h
+const (
+	perfCycles = iota
+	perfInstructions
+	perfCacheMisses
+	perfBranchMisses
+	perfContextSwitches
+)
+
+// Counter per request, or n/a if the agent couldn't open it
+func perRequest(value, requests C.uint64_t, available C.uint32_t, counter int) string {
+	if available&(1<<uint(counter)) == 0 {
+		return "n/a"
+	}
+	if requests == 0 {
+		return "0"
+	}
+	return fmt.Sprintf("%.2f", float64(value)/float64(requests))
+}
+
+func printCounters(stats []*countersStats) {
+	for i, s := range stats {
+		a := s.hdr.Available
+		fmt.Printf("Agent %v cost per request over %v sec\n", i,
+			float64(s.hdr.Duration)/1e6)
+		fmt.Println("#Thread\tRequests\tCycles\tInstructions\tCache misses\tBranch misses\tContext switches")
+		for _, t := range s.threads {
+			fmt.Printf("%v\t%v\t%v\t%v\t%v\t%v\t%v\n", t.Thread,
+				t.Requests,
+				perRequest(t.Cycles, t.Requests, a, perfCycles),
+				perRequest(t.Instructions, t.Requests, a, perfInstructions),
+				perRequest(t.Cache_misses, t.Requests, a, perfCacheMisses),
+				perRequest(t.Branch_misses, t.Requests, a, perfBranchMisses),
+				perRequest(t.Context_switches, t.Requests, a, perfContextSwitches))
+		}
+	}
+}
+
 func getRPS(stats *C.struct_throughput_reply) float64 {
 	return 1e6 * float64(stats.Req_count) / float64(stats.Duration)
 }
@@ -0,0 +1,172 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+package main
+
+// #include "../inc/lancet/coord_proto.h"
+import "C"
+import (
+	"fmt"
+	"time"
+)
+
+// The fewest intervals MSER is applied to
+const minSteadyIntervals = 8
+
+// MSER truncation point of the series: the number of leading
+// observations to drop so that the mean of the rest has the smallest
+// standard error. Searched over the first half only, a minimum at the
+// end of it means that the series is still drifting.
+func mserTruncation(series []float64) (int, bool) {
+	n := len(series)
+	best, bestStat := 0, 0.0
+	for d := 0; d <= n/2; d++ {
+		mean := 0.0
+		for _, v := range series[d:] {
+			mean += v
+		}
+		mean /= float64(n - d)
+		sq := 0.0
+		for _, v := range series[d:] {
+			sq += (v - mean) * (v - mean)
+		}
+		stat := sq / (float64(n-d) * float64(n-d))
+		if d == 0 || stat < bestStat {
+			best, bestStat = d, stat
+		}
+	}
+	return best, best < n/2
+}
+
+// Poll the interval throughput and 99th latency of the agents until
+// both series pass the MSER test, instead of a fixed warm-up sleep.
+// Gives up after maxWarmup seconds and measures anyway.
+func (c *coordinator) waitSteady(agents []*agent) error {
+	rps := make([]float64, 0)
+	p99 := make([]float64, 0)
+	start := time.Now()
+	deadline := start.Add(time.Duration(c.maxWarmup) * time.Second)
+
+	// Drop the interval of the previous load
+	_, err := reportInterval(agents)
+	if err != nil {
+		return fmt.Errorf("Error getting interval replies: %v\n", err)
+	}
+	// A schedule is measured from its start, the trace shows the rest
+	if c.loadSched != "" {
+		fmt.Printf("Load schedule %v, measuring from the start\n", c.loadSched)
+		return nil
+	}
+	for time.Now().Before(deadline) {
+		time.Sleep(time.Duration(c.warmupIntvl) * time.Millisecond)
+		intervals, err := reportInterval(agents)
+		if err != nil {
+			return fmt.Errorf("Error getting interval replies: %v\n", err)
+		}
+		intervalRps := 0.0
+		intervalP99 := 0.0
+		for _, i := range intervals {
+			if i.Duration > 0 {
+				intervalRps += 1e6 * float64(i.Req_count) / float64(i.Duration)
+			}
+			if float64(i.P99) > intervalP99 {
+				intervalP99 = float64(i.P99)
+			}
+		}
+		rps = append(rps, intervalRps)
+		p99 = append(p99, intervalP99)
+		if len(rps) < minSteadyIntervals {
+			continue
+		}
+		rpsCut, rpsSteady := mserTruncation(rps)
+		p99Cut, p99Steady := mserTruncation(p99)
+		if rpsSteady && p99Steady {
+			if p99Cut > rpsCut {
+				rpsCut = p99Cut
+			}
+			fmt.Printf("Steady state after %v sec, warm-up of %v intervals\n",
+				time.Since(start).Seconds(), rpsCut)
+			return nil
+		}
+	}
+	fmt.Printf("No steady state after %v sec, measuring anyway\n", c.maxWarmup)
+	return nil
+}
+
+// The rate the agents that run the load schedule offered over the
+// intervals. The latency agents probe at a constant rate without it.
+func (c *coordinator) scheduledOffered(agents []*agent,
+	intervals []*C.struct_interval_reply) float64 {
+	offered := 0.0
+	for i, reply := range intervals {
+		probe := false
+		for _, a := range c.ltAgents {
+			probe = probe || a == agents[i]
+		}
+		if !probe {
+			offered += float64(reply.Offered)
+		}
+	}
+	return offered
+}
+
+// Wait for the measurement to run. Under a load schedule, print the
+// offered rate of every interval next to the achieved one and the
+// latency, to see how the server absorbs the changes.
+func (c *coordinator) waitMeasure(agents []*agent, duration int) error {
+	if c.loadSched == "" {
+		time.Sleep(time.Duration(duration) * time.Second)
+		return nil
+	}
+	start := time.Now()
+	end := start.Add(time.Duration(duration) * time.Second)
+	fmt.Println("#Time\tOffered\tSent\tAchieved\t50th\t99th")
+	for time.Now().Before(end) {
+		time.Sleep(time.Duration(c.warmupIntvl) * time.Millisecond)
+		intervals, err := reportInterval(agents)
+		if err != nil {
+			return fmt.Errorf("Error getting interval replies: %v\n", err)
+		}
+		offered := c.scheduledOffered(agents, intervals)
+		sent, achieved := 0.0, 0.0
+		p50, p99 := 0.0, 0.0
+		for _, i := range intervals {
+			if i.Duration == 0 {
+				continue
+			}
+			sent += 1e6 * float64(i.Tx_count) / float64(i.Duration)
+			achieved += 1e6 * float64(i.Req_count) / float64(i.Duration)
+			if float64(i.P50) > p50 {
+				p50 = float64(i.P50)
+			}
+			if float64(i.P99) > p99 {
+				p99 = float64(i.P99)
+			}
+		}
+		fmt.Printf("%.2f\t%.0f\t%.0f\t%.0f\t%v\t%v\n",
+			time.Since(start).Seconds(), offered, sent, achieved,
+			p50/1e3, p99/1e3)
+	}
+	return nil
+}
@@ -25,26 +25,58 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/socket.h>
 
 #include <lancet/rand_gen.h>
 #include <lancet/app_proto.h>
+#include <lancet/load_sched.h>
+#include <lancet/tenant.h>
 
-#define IF_NAME "enp65s0"
-#define MAX_THREADS 16
-
+/*
+ * A target endpoint: host:port[@source], unix:<path>, unixpacket:<path>
+ * or vsock:<cid>:<port>. src_len is 0 without a source address.
+ */
 struct host_tuple {
-	uint32_t ip;
-	uint16_t port;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	int socktype;
+	struct sockaddr_storage src;
+	socklen_t src_len;
 };
 
+static inline int target_is_inet(struct host_tuple *target)
+{
+	return target->addr.ss_family == AF_INET ||
+		target->addr.ss_family == AF_INET6;
+}
+
 enum agent_type {
 	THROUGHPUT_AGENT,
 	LATENCY_AGENT,
 	SYMMETRIC_NIC_TIMESTAMP_AGENT,
 	SYMMETRIC_AGENT,
+	CONNECT_AGENT,
+	SYMMETRIC_SW_TIMESTAMP_AGENT,
 	AGENT_NR,
 };
 
+/*
+ * Agents that take the tx and rx timestamps from the kernel, either
+ * from the NIC or from the software stack
+ */
+static inline int kernel_timestamping(enum agent_type atype)
+{
+	return atype == SYMMETRIC_NIC_TIMESTAMP_AGENT ||
+		atype == SYMMETRIC_SW_TIMESTAMP_AGENT;
+}
+
+enum conn_policy {
+	POLICY_RANDOM,
+	POLICY_ROUND_ROBIN,
+	POLICY_LEAST_OUTSTANDING,
+	POLICY_WEIGHTED,
+};
+
 enum transport_protocol_type {
 	TCP,
 	R2P2,
@@ -60,18 +92,46 @@ struct agent_config {
 	struct transport_protocol *tp;
 	struct rand_gen *idist;
 	struct application_protocol *app_proto;
+	char *dump_path;
+	enum conn_policy policy;
+	double target_weights[4096];
+	char *if_name;
+	int max_pending; // per connection, power of two
+	int rx_buf_size; // per connection, power of two
+	char *placement;
+	char *manager_cpus;
+	int perf_counters;
+	struct load_sched *load_sched;
+	struct tenant tenants[MAX_TENANTS];
+	int tenant_count;
 };
 
 
 struct agent_config *parse_arguments(int argc, char **argv);
 int get_conn_count(void);
 int get_thread_count(void);
+int get_thread_conn_count(int thread);
+int get_thread_conn_base(int thread);
 int get_target_count(void);
 struct host_tuple *get_targets(void);
 struct rand_gen *get_ia_gen(void);
+struct application_protocol *get_app_proto(void);
 struct request *prepare_request(void);
 struct byte_req_pair process_response(char *buf, int size);
 long get_ia(void);
+long get_next_tx(long next_tx);
+struct load_sched *get_load_sched(void);
+int get_tenant_count(void);
+struct tenant *get_tenants(void);
+int get_target_tenant(int target);
+long get_tenant_next_tx(int tenant, long next_tx);
+double get_offered_rate(uint32_t load, long from, long to);
 void set_load(uint32_t load);
 enum agent_type get_agent_type(void);
 int get_agent_tid(void);
+enum conn_policy get_conn_policy(void);
+double *get_target_weights(void);
+int get_perf_counters(void);
+char *get_if_name(void);
+int get_max_pending(void);
+int get_rx_buf_size(void);
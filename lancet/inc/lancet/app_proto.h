@@ -40,6 +40,7 @@ enum app_proto_type {
 	PROTO_SYNTHETIC,
 	PROTO_ASCII_MEMCACHED,
 	PROTO_ASCII_MEMCACHED_SVC,
+	PROTO_NR, // any protocol, through the function pointers
 };
 
 struct application_protocol {
@@ -64,6 +65,28 @@ static inline struct byte_req_pair consume_response(
 	return proto->consume_response(proto, response);
 };
 
+/*
+ * Complete responses in len bytes for the fixed size protocols, shared
+ * with the request kernels
+ */
+static inline struct byte_req_pair echo_responses(struct iovec *msg, size_t len)
+{
+	struct byte_req_pair res;
+
+	res.reqs = len / msg->iov_len;
+	res.bytes = res.reqs * msg->iov_len;
+	return res;
+}
+
+static inline struct byte_req_pair synthetic_responses(size_t len)
+{
+	struct byte_req_pair res;
+
+	res.reqs = len / sizeof(long);
+	res.bytes = res.reqs * sizeof(long);
+	return res;
+}
+
 /*
  * Specific datastructure for ascii-memecached protocol
  */
@@ -0,0 +1,42 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include <lancet/tp_proto.h>
+
+/*
+ * Connection selection. Only the open connections below
+ * get_max_pending() outstanding requests are candidates, so a pick never fails while there is
+ * capacity left. Every policy picks in O(1).
+ */
+#define NOT_SELECTABLE 0xffff
+
+int select_init(struct tcp_connection *conns, int count);
+void select_update(struct tcp_connection *conn);
+struct tcp_connection *select_conn(void);
+/* With tenants, a random connection of the tenant, -b is random */
+struct tcp_connection *select_tenant_conn(int tenant);
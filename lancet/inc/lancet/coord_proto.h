@@ -43,6 +43,12 @@ enum {
 enum {
 	REPORT_THROUGHPUT = 0,
 	REPORT_LATENCY,
+	REPORT_TARGETS,
+	REPORT_CONNECT,
+	REPORT_READINESS,
+	REPORT_TELEMETRY,
+	REPORT_COUNTERS,
+	REPORT_INTERVAL,
 };
 
 /*
@@ -55,6 +61,12 @@ enum {
 	REPLY_CONVERGENCE,
 	REPLY_IA_COMP,
 	REPLY_IID,
+	REPLY_TARGET_STATS,
+	REPLY_CONNECT_STATS,
+	REPLY_READINESS,
+	REPLY_TELEMETRY,
+	REPLY_COUNTERS,
+	REPLY_INTERVAL,
 	// REPLY_KV_STATS etc...
 };
 
@@ -80,6 +92,8 @@ struct __attribute__((__packed__)) throughput_reply {
 	uint64_t Tx_bytes;
 	uint64_t Req_count;
 	uint64_t Duration;
+	uint64_t Reconnects;
+	uint64_t Failed_sends;
 };
 
 struct __attribute__((__packed__)) latency_reply {
@@ -98,3 +112,135 @@ struct __attribute__((__packed__)) latency_reply {
 	uint64_t P99;
 	uint64_t P99_k;
 };
+
+/*
+ * REPLY_TARGET_STATS payload: a target_reply_hdr followed by
+ * Target_count target_reply
+ */
+struct __attribute__((__packed__)) target_reply_hdr {
+	uint32_t Target_count;
+	uint32_t Pad;
+	uint64_t Max_p99;
+	uint64_t Min_p99;
+	double Jain_p99;
+	double Jain_throughput;
+};
+
+struct __attribute__((__packed__)) target_reply {
+	uint32_t Target;
+	uint32_t Pad;
+	uint64_t Req_count;
+	uint64_t Avg_lat;
+	uint64_t P50;
+	uint64_t P90;
+	uint64_t P99;
+};
+
+/*
+ * REPLY_CONNECT_STATS payload: a connect_reply followed by Bucket_count
+ * non-empty buckets of the connect latency histogram
+ */
+struct __attribute__((__packed__)) connect_reply {
+	uint64_t Connects;
+	uint64_t Connect_errors;
+	uint64_t Request_errors;
+	uint64_t Duration;
+	uint64_t Avg_lat;
+	uint64_t P50;
+	uint64_t P90;
+	uint64_t P99;
+	uint64_t P999;
+	uint32_t Bucket_count;
+	uint32_t Pad;
+};
+
+struct __attribute__((__packed__)) hist_bucket_reply {
+	uint64_t Value;
+	uint64_t Count;
+};
+
+/*
+ * REPLY_READINESS payload: a readiness_hdr followed by Target_count
+ * target_readiness_reply. Times are in ns since the agent start.
+ */
+struct __attribute__((__packed__)) readiness_hdr {
+	uint32_t Target_count;
+	uint32_t Ready_targets;
+	uint64_t Elapsed;
+};
+
+struct __attribute__((__packed__)) target_readiness_reply {
+	uint32_t Target;
+	uint32_t Conns;
+	uint32_t Ready;
+	uint32_t Retries;
+	uint64_t First_ready;
+	uint64_t All_ready;
+};
+
+/*
+ * REPLY_TELEMETRY payload: a telemetry_hdr followed by Thread_count
+ * thread_telemetry_reply. The lag is how late the sends were on their
+ * schedule, in ns. Window_full counts the sends that waited for a
+ * connection below max_pending, their lag is left out.
+ */
+struct __attribute__((__packed__)) telemetry_hdr {
+	uint32_t Thread_count;
+	uint32_t Pad;
+	uint64_t Duration;
+};
+
+struct __attribute__((__packed__)) thread_telemetry_reply {
+	uint32_t Thread;
+	uint32_t Node;
+	uint64_t Iterations;
+	uint64_t Idle_iterations;
+	uint64_t Sends;
+	uint64_t Wakeups;
+	uint64_t Events;
+	uint64_t Pick_failures;
+	uint64_t Window_full;
+	uint64_t Lag_avg;
+	uint64_t Lag_p99;
+	uint64_t Lag_p999;
+};
+
+/*
+ * REPLY_COUNTERS payload: a counters_hdr followed by Thread_count
+ * thread_counters_reply, counted over the measurement. Available is the
+ * bitmask of the counters the agent could open, in the order below.
+ */
+struct __attribute__((__packed__)) counters_hdr {
+	uint32_t Thread_count;
+	uint32_t Available;
+	uint64_t Duration;
+};
+
+struct __attribute__((__packed__)) thread_counters_reply {
+	uint32_t Thread;
+	uint32_t Pad;
+	uint64_t Requests;
+	uint64_t Cycles;
+	uint64_t Instructions;
+	uint64_t Cache_misses;
+	uint64_t Branch_misses;
+	uint64_t Context_switches;
+};
+
+/*
+ * REPLY_INTERVAL payload: the requests, the responses and the latency
+ * since the previous REPORT_INTERVAL or START_LOAD, measuring or not.
+ * Duration is in us, the latencies in ns and 0 without latency samples.
+ * Offered is the mean rate of the load schedules over the interval, in
+ * requests per second.
+ */
+struct __attribute__((__packed__)) interval_reply {
+	uint64_t Duration;
+	uint64_t Offered;
+	uint64_t Tx_count;
+	uint64_t Req_count;
+	uint64_t Lat_count;
+	uint64_t Avg_lat;
+	uint64_t P50;
+	uint64_t P99;
+};
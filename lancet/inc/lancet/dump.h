@@ -0,0 +1,57 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Raw sample dump file format: a dump_file_hdr followed by sample
+ * records in the order they were flushed (not sorted by time).
+ */
+#define DUMP_MAGIC 0x544e434c // "LCNT"
+#define DUMP_VERSION 2
+
+struct __attribute__((__packed__)) dump_file_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t thread_count;
+	uint32_t conn_count;
+	uint32_t target_count;
+};
+
+struct __attribute__((__packed__)) sample_record {
+	uint64_t tx; // ns, in the clock domain of the tx timestamps
+	uint32_t lat; // ns
+	uint32_t conn; // agent-wide connection index
+	uint32_t target; // index in the -s target list
+};
+
+int dump_init(char *path);
+int dump_thread_init(void);
+void dump_sample(struct timespec *tx, uint32_t lat, uint32_t conn,
+		uint32_t target);
+void dump_flush(void);
@@ -0,0 +1,64 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram: values below 16 have their own bucket,
+ * every power of two above is split in 16 buckets, so the relative
+ * error is below 6.25% up to the 32-bit limit.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct lat_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint32_t buckets[HIST_BUCKETS];
+};
+
+static inline int hist_bucket(uint32_t val)
+{
+	int msb;
+
+	if (val < HIST_SUB)
+		return val;
+	msb = 31 - __builtin_clz(val);
+	return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+		((val >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static inline void hist_add(struct lat_hist *hist, uint32_t val)
+{
+	hist->count++;
+	hist->sum += val;
+	hist->buckets[hist_bucket(val)]++;
+}
+
+uint64_t hist_bucket_value(int bucket);
+void hist_merge(struct lat_hist *dst, struct lat_hist *src);
+uint64_t hist_percentile(struct lat_hist *hist, double p);
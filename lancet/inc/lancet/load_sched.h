@@ -0,0 +1,79 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Load schedules, evaluated by every thread on its own send times so
+ * that the rate changes need no coordinator round-trip. A schedule is a
+ * factor of the START_LOAD rate over the time since START_LOAD:
+ *   ramp:<from>:<to>:<sec>                   linear, then holds <to>
+ *   step:<f>:<sec>,<f>:<sec>,...             then holds the last <f>
+ *   sine:<amplitude>:<period sec>            1 + amplitude * sin
+ *   onoff:<on f>:<on sec>:<off f>:<off sec>  repeats
+ *   mmpp:<f>:<mean sec>,<f>:<mean sec>,...   exponential sojourns, jumps
+ *                                            to any other state
+ * The inter-arrivals drawn for the START_LOAD rate are stretched by the
+ * integral of the factor, so the arrivals stay Poisson under exp.
+ */
+#define SCHED_MAX_SEGMENTS 64
+/* Schedules per agent, one per tenant and the global one */
+#define SCHED_MAX 65
+/* ns, the ramps and the sine are constant over this */
+#define SCHED_RESOLUTION 1000000
+
+enum sched_type {
+	SCHED_RAMP,
+	SCHED_STEP,
+	SCHED_SINE,
+	SCHED_ONOFF,
+	SCHED_MMPP,
+};
+
+struct sched_segment {
+	double from;
+	double to;
+	long duration; // ns, the mean sojourn for MMPP
+};
+
+struct load_sched {
+	int id;
+	enum sched_type type;
+	int count;
+	struct sched_segment seg[SCHED_MAX_SEGMENTS];
+	double amplitude;
+	long period; // ns
+	/* Every thread replays the same MMPP path */
+	unsigned short seed[3];
+	/* time_ns() at START_LOAD and the rate it set */
+	long start;
+	uint32_t load;
+};
+
+struct load_sched *init_load_sched(char *spec);
+void load_sched_start(struct load_sched *s, uint32_t load);
+long load_sched_next(struct load_sched *s, long at, long ia);
+double load_sched_rate(struct load_sched *s, long from, long to);
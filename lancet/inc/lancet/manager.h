@@ -27,9 +27,10 @@
 #include <lancet/stats.h>
 
 #define MANAGER_PORT 5001
-#define AGG_SAMPLE_SIZE 0x100000
+#define AGG_SAMPLE_SIZE 0x400000
 
 int should_load(void);
 int should_measure(void);
+void wait_for_phase(long timeout);
 int manager_run(void);
 int manager_init(int thread_count);
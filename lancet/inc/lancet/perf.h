@@ -0,0 +1,137 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*
+ * Per-thread hardware counters, shared by the agent and the servers.
+ * Every counter is opened on its own so that a missing one, e.g. in a
+ * VM without a PMU, only disables that counter. The counters of a thread
+ * can be controlled and read from any thread of the process.
+ */
+enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_CONTEXT_SWITCHES,
+	PERF_COUNTER_NR,
+};
+
+struct perf_counters {
+	int fd[PERF_COUNTER_NR]; // -1 if not available
+};
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} perf_events[PERF_COUNTER_NR] = {
+	[PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	[PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	[PERF_CACHE_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	[PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	[PERF_CONTEXT_SWITCHES] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+/*
+ * Open the counters of the calling thread, disabled. The kernel side of
+ * the requests is counted when perf_event_paranoid allows it.
+ */
+static inline void perf_counters_open(struct perf_counters *pc)
+{
+	struct perf_event_attr attr;
+	int i;
+
+	for (i=0;i<PERF_COUNTER_NR;i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[i].type;
+		attr.config = perf_events[i].config;
+		attr.disabled = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+		pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (pc->fd[i] < 0) {
+			attr.exclude_kernel = 1;
+			pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		}
+	}
+}
+
+/*
+ * PERF_EVENT_IOC_RESET, PERF_EVENT_IOC_ENABLE or PERF_EVENT_IOC_DISABLE
+ */
+static inline void perf_counters_ctl(struct perf_counters *pc, unsigned long op)
+{
+	int i;
+
+	for (i=0;i<PERF_COUNTER_NR;i++)
+		if (pc->fd[i] >= 0)
+			ioctl(pc->fd[i], op, 0);
+}
+
+/*
+ * Bitmask of the counters that could be opened
+ */
+static inline uint32_t perf_counters_available(struct perf_counters *pc)
+{
+	uint32_t mask = 0;
+	int i;
+
+	for (i=0;i<PERF_COUNTER_NR;i++)
+		if (pc->fd[i] >= 0)
+			mask |= 1 << i;
+	return mask;
+}
+
+/*
+ * The counts since the last reset, scaled up when the PMU multiplexed
+ * the counters. The missing counters read 0.
+ */
+static inline void perf_counters_read(struct perf_counters *pc,
+		uint64_t *values)
+{
+	uint64_t buf[3]; // value, time enabled, time running
+	int i;
+
+	for (i=0;i<PERF_COUNTER_NR;i++) {
+		values[i] = 0;
+		if (pc->fd[i] < 0)
+			continue;
+		if (read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf))
+			continue;
+		if (buf[2] && buf[2] < buf[1])
+			values[i] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+		else
+			values[i] = buf[0];
+	}
+}
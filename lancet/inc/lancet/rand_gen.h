@@ -25,9 +25,21 @@
 #pragma once
 
 #include <stdint.h>
+#include <math.h>
 #include <stdlib.h>
 
+/*
+ * Distributions with a specialized request kernel, the rest are generic
+ */
+enum rand_kind {
+	RAND_GENERIC,
+	RAND_EXP,
+	RAND_FIXED,
+	RAND_KIND_NR,
+};
+
 struct rand_gen {
+	enum rand_kind kind;
 	/* Void pointer to hold any relevant data for each distribution */
 	void *params;
 	/* Set distribution's average */
@@ -56,6 +68,23 @@ static inline double generate(struct rand_gen *generator)
 	}
 }
 
+/*
+ * generate() for a kind known at compile time, so that the specialized
+ * kinds are computed inline without the indirect calls
+ */
+static __always_inline double generate_kind(
+		struct rand_gen *generator, const enum rand_kind kind)
+{
+	switch (kind) {
+	case RAND_EXP:
+		return -log(drand48()) / *(double *)generator->params;
+	case RAND_FIXED:
+		return *(double *)generator->params;
+	default:
+		return generate(generator);
+	}
+}
+
 static inline void set_avg(struct rand_gen *gen, double avg)
 {
 	return gen->set_avg(gen, avg);
@@ -0,0 +1,119 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+/*
+ * Request kernels: the per request work of the agent loops for a protocol
+ * and inter-arrival distribution known at compile time. The loops are
+ * instantiated for every pair with a kernel and picked when the thread
+ * starts, so that the hot path has no indirect calls. PROTO_NR and
+ * RAND_GENERIC go through the function pointers.
+ */
+#pragma once
+
+#include <math.h>
+
+#include <lancet/agent.h>
+#include <lancet/app_proto.h>
+#include <lancet/load_sched.h>
+#include <lancet/rand_gen.h>
+
+struct req_kernel {
+	struct application_protocol *proto;
+	struct rand_gen *idist;
+	struct load_sched *sched;
+	struct request req;
+	struct iovec rx;
+	long synth_arg;
+};
+
+static inline void kernel_init(struct req_kernel *k)
+{
+	k->proto = get_app_proto();
+	k->idist = get_ia_gen();
+	k->sched = get_load_sched();
+}
+
+/*
+ * The protocols that have a kernel, the rest run on the PROTO_NR one
+ */
+static inline enum app_proto_type kernel_proto(enum app_proto_type type)
+{
+	if ((type == PROTO_ECHO) || (type == PROTO_SYNTHETIC))
+		return type;
+	return PROTO_NR;
+}
+
+/* Next inter-arrival time in ns, as get_ia() */
+static __always_inline long kernel_ia(struct req_kernel *k, const enum rand_kind kind)
+{
+	if (kind == RAND_GENERIC)
+		return get_ia();
+	return lround(generate_kind(k->idist, kind) * 1000);
+}
+
+/* Send time of the request after the one at next_tx, as get_next_tx() */
+static __always_inline long kernel_next_tx(struct req_kernel *k, long next_tx,
+		const enum rand_kind kind)
+{
+	long ia = kernel_ia(k, kind);
+
+	if (k->sched)
+		return load_sched_next(k->sched, next_tx, ia);
+	return next_tx + ia;
+}
+
+static __always_inline struct request *kernel_request(struct req_kernel *k,
+		const enum app_proto_type type)
+{
+	switch (type) {
+	case PROTO_ECHO:
+		k->req.iovs[0] = *(struct iovec *)k->proto->arg;
+		break;
+	case PROTO_SYNTHETIC:
+		k->synth_arg = lround(generate(k->proto->arg));
+		k->req.iovs[0].iov_base = &k->synth_arg;
+		k->req.iovs[0].iov_len = sizeof(long);
+		break;
+	default:
+		create_request(k->proto, &k->req);
+		return &k->req;
+	}
+	k->req.iov_cnt = 1;
+	k->req.meta = NULL;
+	return &k->req;
+}
+
+static __always_inline struct byte_req_pair kernel_response(struct req_kernel *k,
+		const enum app_proto_type type, char *buf, int size)
+{
+	switch (type) {
+	case PROTO_ECHO:
+		return echo_responses(k->proto->arg, size);
+	case PROTO_SYNTHETIC:
+		return synthetic_responses(size);
+	default:
+		k->rx.iov_base = buf;
+		k->rx.iov_len = size;
+		return consume_response(k->proto, &k->rx);
+	}
+}
@@ -0,0 +1,47 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#pragma once
+
+#include <stdint.h>
+
+#define MAX_SORT_WORKERS 16
+
+/*
+ * Sort count 64-bit keys in place using an LSD radix sort.
+ * scratch must hold at least count keys. The work is split among up to
+ * workers threads (the caller being one of them).
+ */
+void radix_sort(uint64_t *keys, uint64_t *scratch, uint32_t count,
+		int workers);
+/*
+ * Number of sort workers that can run without disturbing busy_threads
+ * pinned agent threads, i.e. the caller plus the idle cores.
+ */
+int idle_sort_workers(int busy_threads);
+/*
+ * Pin the workers other than the caller to the given idle CPUs, after
+ * which idle_sort_workers() counts those instead of all the online CPUs
+ */
+void pin_sort_workers(int *cpus, int count);
@@ -28,15 +28,15 @@
 #include <assert.h>
 
 #include <lancet/rand_gen.h>
+#include <lancet/hist.h>
 
-#define MAX_PER_THREAD_SAMPLES 131072
+#define MAX_PER_THREAD_SAMPLES 524288
 #define MAX_PER_THREAD_TX_SAMPLES 2048
 #ifdef QUALITY_EXP
 #define REFERENCE_IA_SIZE 2048
 #else
 #define REFERENCE_IA_SIZE 8192
 #endif
-
 struct byte_req_pair {
 	uint64_t bytes;
 	uint64_t reqs;
@@ -55,11 +55,17 @@ struct tx_samples {
 struct throughput_stats {
 	struct byte_req_pair rx;
 	struct byte_req_pair tx;
+	uint64_t reconnects;
+	uint64_t failed_sends;
 };
 
-struct lat_sample {
-	uint64_t nsec;
-	struct timespec tx; // used for iid-ness checks
+/*
+ * Latency samples are stored as columns so that the hot path and the
+ * aggregation only touch 8 bytes per sample
+ */
+struct lat_samples {
+	uint32_t *lat; // latency in ns, saturated at ~4.29 s
+	int64_t *tx; // ns since the first tx of the measurement, for iid-ness
 };
 
 struct latency_stats {
@@ -80,7 +86,72 @@ struct latency_stats {
 	uint64_t p99_i;
 	uint64_t p99;
 	uint64_t p99_k;
-	struct lat_sample samples[];
+	/* Not cleared with the rest of the stats */
+	struct lat_samples samples;
+};
+
+/*
+ * Per-target breakdown, computed from per-thread histograms
+ */
+struct target_latency {
+	uint32_t target;
+	uint64_t count;
+	uint64_t avg_lat;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+};
+
+struct target_fairness {
+	uint64_t max_p99;
+	uint64_t min_p99;
+	double jain_p99;
+	double jain_throughput;
+};
+
+/*
+ * Connection establishment, for the connect agent
+ */
+struct connect_stats {
+	struct lat_hist hist;
+	uint64_t connect_errors;
+	uint64_t request_errors;
+};
+
+/*
+ * Agent loop telemetry, to tell whether the agent kept up with its
+ * schedule. Only written by the thread, which resets it with its stats.
+ */
+struct loop_stats {
+	uint64_t iterations;
+	uint64_t idle_iterations; // nothing sent or received
+	uint64_t sends;
+	uint64_t wakeups; // polls that returned events
+	uint64_t events;
+	uint64_t pick_failures; // no connection could take the request
+	uint64_t window_full; // sends that waited for a connection with room
+	struct lat_hist lag; // ns behind the schedule at send
+};
+
+/*
+ * Running totals of a thread since it started, kept outside of the
+ * measurements, which the manager diffs into interval summaries
+ */
+struct interval_stats {
+	uint64_t sent;
+	uint64_t reqs;
+	struct lat_hist lat;
+};
+
+/*
+ * Connection setup progress of a target, kept for the whole run
+ */
+struct target_readiness {
+	uint32_t conns;
+	uint32_t ready;
+	uint32_t retries;
+	uint64_t first_ready; // ns since the agent start, 0 if none
+	uint64_t all_ready; // ns since the agent start, 0 if not all
 };
 
 union stats {
@@ -89,16 +160,21 @@ union stats {
 };
 
 void clear_stats(union stats *stats);
-void compute_latency_percentiles(struct latency_stats *lt_s);
+int alloc_lat_samples(struct lat_samples *samples, uint32_t size);
+int init_stats_registry(int count);
 int init_per_thread_stats(void);
 int add_throughput_tx_sample(struct byte_req_pair tx_p);
 int add_throughput_rx_sample(struct byte_req_pair rx_p);
 int add_tx_timestamp(struct timespec *tx_ts);
-int add_latency_sample(long diff, struct timespec *tx);
+void add_reconnect(void);
+void add_failed_send(void);
+int add_latency_sample(long diff, struct timespec *tx, uint32_t conn,
+		uint32_t target);
 void compute_latency_percentiles_ci(struct latency_stats *lt_s);
 void set_per_thread_samples(int samples, double sr);
-uint32_t compute_convergence(struct lat_sample *samples, int size);
-void clear_all_stats(void);
+uint32_t compute_convergence(struct latency_stats *lt_s);
+int flip_stats_buffer(void);
+void use_stats_buffer(int buffer);
 void aggregate_throughput_stats(union stats *agg_stats);
 void aggregate_latency_samples(union stats *agg_stats);
 int check_ia(void);
@@ -106,3 +182,18 @@ void collect_reference_ia(struct rand_gen *gen);
 void init_reference_ia_dist(struct rand_gen *gen);
 void set_reference_load(uint32_t load);
 double check_iid(struct latency_stats *lt_s);
+int compute_target_stats(struct target_latency *res,
+		struct target_fairness *fairness);
+int add_connect_sample(long diff);
+void add_connect_error(void);
+void add_request_error(void);
+void aggregate_connect_stats(struct connect_stats *agg);
+struct loop_stats *get_loop_stats(int thread);
+void aggregate_interval_stats(struct interval_stats *agg);
+void control_perf_counters(unsigned long op);
+uint32_t read_perf_counters(int thread, uint64_t *values, uint64_t *requests);
+int init_readiness(void);
+void add_connect_retry(uint32_t target);
+void add_target_ready(uint32_t target);
+void remove_target_ready(uint32_t target);
+struct target_readiness *get_readiness(long *elapsed);
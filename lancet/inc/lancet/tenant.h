@@ -0,0 +1,59 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+#pragma once
+
+#include <stdint.h>
+
+#include <lancet/app_proto.h>
+#include <lancet/load_sched.h>
+#include <lancet/rand_gen.h>
+
+/*
+ * A group of targets with its own share of the load, request protocol,
+ * inter-arrival distribution and load schedule. Every thread runs an
+ * open-loop arrival process per tenant, e.g. for a victim VM next to
+ * noisy neighbours.
+ */
+#define MAX_TENANTS 64
+
+struct tenant {
+	int first_target;
+	int last_target;
+	double rate; // relative, START_LOAD sets the sum
+	struct application_protocol *app_proto;
+	struct rand_gen *idist;
+	struct load_sched *load_sched;
+};
+
+int parse_tenant(char *spec, struct tenant *t);
+int init_tenants(struct tenant *tenants, int count, int target_count,
+		struct application_protocol *app_proto, char *idist_spec,
+		char *sched_spec);
+int find_tenant(struct tenant *tenants, int count, int target);
+void tenants_set_load(struct tenant *tenants, int count, uint32_t load,
+		int thread_count);
+double tenants_offered_rate(struct tenant *tenants, int count,
+		uint32_t load, long from, long to);
+long tenant_next_tx(struct tenant *t, long next_tx);
@@ -39,12 +39,24 @@ struct pending_tx_timestamps {
 	uint32_t head; // waiting for timestamps
 	uint32_t tail; // timestamp received
 	uint32_t consumed; // matched with reply
-	struct timestamp_info pending[MAX_PENDING_REQS];
+	uint32_t mask; // ring size - 1
+	struct timestamp_info *pending;
 };
 
+/*
+ * A new socket starts counting the bytes for the timestamps again
+ */
+static inline void reset_tx_timestamps(struct pending_tx_timestamps *tx_timestamps)
+{
+	tx_timestamps->tx_byte_counter = 0;
+	tx_timestamps->head = 0;
+	tx_timestamps->tail = 0;
+	tx_timestamps->consumed = 0;
+}
+
 int enable_nic_timestamping(char *if_name);
 int disable_nic_timestamping(char *if_name);
-int sock_enable_timestamping(int fd);
+int sock_enable_timestamping(int fd, int hardware);
 ssize_t timestamp_recv(int sockfd, void *buf, size_t len, int flags,
 		struct timestamp_info *last_rx_time);
 int get_tx_timestamp(int sockfd, struct pending_tx_timestamps *tx_timestamps);
@@ -0,0 +1,48 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+/*
+ * Agent thread placement from the sysfs CPU topology
+ */
+#pragma once
+
+/*
+ * Placement policies:
+ * seq: thread i on the i-th available CPU
+ * core: one thread per physical core, SMT siblings only when out of cores
+ * nic: the CPUs of the NUMA node of the -n interface, cores first
+ * list:<cpulist>: the given CPUs in order, e.g. list:0-3,8
+ * The manager CPUs are never used for agent threads.
+ */
+int placement_init(char *policy, char *manager_cpus, char *if_name,
+		int thread_count);
+int placement_cpu(int thread);
+/* NUMA node of the thread's CPU, below placement_node_count() */
+int placement_node(int thread);
+int placement_node_count(void);
+/*
+ * The online CPUs that neither the first thread_count agent threads nor
+ * the manager run on. Returns their number.
+ */
+int placement_idle_cpus(int thread_count, int *res, int max);
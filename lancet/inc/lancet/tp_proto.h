@@ -53,25 +53,35 @@ static inline struct transport_protocol *init_transport_protocol(enum transport_
 }
 
 /*
- * TCP specific
+ * TCP specific. The outstanding requests and the receive buffer of a
+ * connection are sized at startup with -d and -l.
  */
-//#ifdef SINGLE_REQ
-//#define MAX_PENDING_REQS 1
-//#else
-//#ifdef REQ_4
-//#define MAX_PENDING_REQS 1
-//#else
-//#define MAX_PENDING_REQS 256
-//#endif
-//#endif
-#define MAX_PENDING_REQS 16
+#define DEFAULT_PENDING_REQS 16
+#define DEFAULT_RX_BUF 4096
+/* The per-thread connection indices are uint16_t and 0xffff is NOT_SELECTABLE */
+#define MAX_THREAD_CONNS 65534
+
+enum conn_state {
+	CONN_OPEN,
+	CONN_CLOSED,
+	CONN_CONNECTING,
+};
 
-#define MAX_PAYLOAD 4000
 struct tcp_connection {
 	uint32_t fd;
 	uint16_t idx;
-	uint16_t closed;
+	uint16_t state;
 	uint16_t pending_reqs;
-	uint16_t buffer_idx;
-	char buffer[MAX_PAYLOAD];
+	uint16_t target;
+	uint16_t select_pos; // position in the selectable connections
+	uint16_t group_pos; // position in the policy group
+	uint16_t group;
+	uint16_t tenant;
+	uint16_t tenant_pos; // position in the tenant's connections
+	uint16_t opened; // has been open before, so the next open is a reconnect
+	uint16_t attempts;
+	long retry_at;
+	uint32_t rx_head; // first byte not parsed yet
+	uint32_t rx_tail; // end of the received bytes
+	char *buffer;
 };
@@ -1,25 +1,48 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <linux/vm_sockets.h>
 
 #include <lancet/misc.h>
+#include <lancet/perf.h>
 
 #define MAX_EVENTS 64
 #define BACKLOG 8192
 #define MAX_THREADS 64
 
 static __thread int epollfd;
-static int port;
-static unsigned long s_ip;
+static struct sockaddr_storage listen_addr;
+static socklen_t listen_len;
+/* Unix and vsock listeners can't be REUSEPORT, all threads share one */
+static int shared_sock = -1;
+static int is_tcp = 1;
+
+/*
+ * With -P every thread counts its requests and hardware counters, and
+ * the cost per request is printed every interval
+ */
+struct thread_counters {
+	struct perf_counters pc;
+	uint64_t requests;
+	uint64_t last[PERF_COUNTER_NR + 1]; // the reporter's previous reads
+} __attribute__((aligned(64)));
+
+static struct thread_counters counters[MAX_THREADS];
+static __thread struct thread_counters *self;
+static int perf_interval;
+static int thread_count;
 
 static void setnonblocking(int fd)
 {
@@ -63,11 +86,46 @@ static void process_req(int fd)
 
 	ret = write(fd, &reply, sizeof(long));
 	assert(ret == sizeof(long));
+	__atomic_store_n(&self->requests, self->requests + 1, __ATOMIC_RELAXED);
+}
+
+static void *perf_thread_main(void *arg)
+{
+	uint64_t values[PERF_COUNTER_NR], delta[PERF_COUNTER_NR + 1];
+	uint64_t requests;
+	struct thread_counters *c;
+	int i, j;
+
+	printf("#Requests\tCycles/req\tInstructions/req\tCache misses/req\tBranch misses/req\tContext switches/req\n");
+	while (1) {
+		sleep(perf_interval);
+		memset(delta, 0, sizeof(delta));
+		for (i=0;i<thread_count;i++) {
+			c = &counters[i];
+			requests = __atomic_load_n(&c->requests, __ATOMIC_RELAXED);
+			perf_counters_read(&c->pc, values);
+			for (j=0;j<PERF_COUNTER_NR;j++) {
+				delta[j] += values[j] - c->last[j];
+				c->last[j] = values[j];
+			}
+			delta[PERF_COUNTER_NR] += requests - c->last[PERF_COUNTER_NR];
+			c->last[PERF_COUNTER_NR] = requests;
+		}
+		requests = delta[PERF_COUNTER_NR] ? delta[PERF_COUNTER_NR] : 1;
+		printf("%lu\t%.1f\t%.1f\t%.3f\t%.3f\t%.3f\n",
+				delta[PERF_COUNTER_NR],
+				(double)delta[PERF_CYCLES] / requests,
+				(double)delta[PERF_INSTRUCTIONS] / requests,
+				(double)delta[PERF_CACHE_MISSES] / requests,
+				(double)delta[PERF_BRANCH_MISSES] / requests,
+				(double)delta[PERF_CONTEXT_SWITCHES] / requests);
+		fflush(stdout);
+	}
+	return NULL;
 }
 
 void *tcp_thread_main(void *arg)
 {
-	struct sockaddr_in sin;
 	int sock;
 	int one;
 	int ret, i, nfds, conn_sock;
@@ -75,7 +133,19 @@ void *tcp_thread_main(void *arg)
 	struct epoll_event ev, events[MAX_EVENTS];
 	struct conn *conn;
 
-	sock = socket(AF_INET, SOCK_STREAM, 0);
+	thread_no = (long) arg;
+	self = &counters[thread_no];
+	if (perf_interval) {
+		perf_counters_open(&self->pc);
+		perf_counters_ctl(&self->pc, PERF_EVENT_IOC_ENABLE);
+	}
+
+	if (shared_sock >= 0) {
+		sock = shared_sock;
+		goto listening;
+	}
+
+	sock = socket(listen_addr.ss_family, SOCK_STREAM, 0);
 	if (!sock) {
 		perror("socket");
 		exit(1);
@@ -98,13 +168,16 @@ void *tcp_thread_main(void *arg)
 
 	}
 
-	memset(&sin, 0, sizeof(sin));
-	sin.sin_family = AF_INET;
-	//sin.sin_addr.s_addr = htonl(0);
-	sin.sin_addr.s_addr = s_ip;
-	sin.sin_port = htons(port);
+	/* The wildcard address takes IPv4 too */
+	if (listen_addr.ss_family == AF_INET6) {
+		one = 0;
+		if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (void *) &one, sizeof(one))) {
+			perror("setsockopt(IPV6_V6ONLY)");
+			exit(1);
+		}
+	}
 
-	if (bind(sock, (struct sockaddr*)&sin, sizeof(sin))) {
+	if (bind(sock, (struct sockaddr*)&listen_addr, listen_len)) {
 		perror("bind");
 		exit(1);
 
@@ -115,7 +188,7 @@ void *tcp_thread_main(void *arg)
 		exit(1);
 	}
 
-	thread_no = (long) arg;
+listening:
 	epollfd = epoll_create1(0);
 	ev.events = EPOLLIN;
 	ev.data.u32 = 0;
@@ -128,12 +201,16 @@ void *tcp_thread_main(void *arg)
 		for (i = 0; i < nfds; i++) {
 			if (events[i].data.u32 == 0) {
 				conn_sock = accept(sock, NULL, NULL);
+				/* Another thread took it from the shared listener */
+				if (conn_sock == -1 && errno == EAGAIN)
+					continue;
 				if (conn_sock == -1) {
 					perror("accept");
 					exit(EXIT_FAILURE);
 				}
 				setnonblocking(conn_sock);
-				if (setsockopt(conn_sock, IPPROTO_TCP, TCP_NODELAY, (void *) &one, sizeof(one))) {
+				one = 1;
+				if (is_tcp && setsockopt(conn_sock, IPPROTO_TCP, TCP_NODELAY, (void *) &one, sizeof(one))) {
 					perror("setsockopt(TCP_NODELAY)");
 					exit(1);
 				}
@@ -149,27 +226,153 @@ void *tcp_thread_main(void *arg)
 	}
 }
 
+/*
+ * Whether the host can bind IPv6 sockets, it can't with IPv6 disabled
+ */
+static int inet6_available(void)
+{
+	struct sockaddr_in6 addr;
+	int sock, ret;
+
+	sock = socket(AF_INET6, SOCK_STREAM, 0);
+	if (sock < 0)
+		return 0;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_any;
+	ret = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	close(sock);
+	return !ret;
+}
+
+/*
+ * Resolve the address to listen on, IPv4, IPv6 or a hostname. Without
+ * one listen on all the interfaces of both families, or of IPv4 on
+ * hosts without IPv6.
+ */
+static int listen_inet(char *host, char *service)
+{
+	struct addrinfo hints, *res;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	if (host)
+		hints.ai_family = AF_UNSPEC;
+	else
+		hints.ai_family = inet6_available() ? AF_INET6 : AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+	ret = getaddrinfo(host, service, &hints, &res);
+	if (ret) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
+		return -1;
+	}
+	memcpy(&listen_addr, res->ai_addr, res->ai_addrlen);
+	listen_len = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	if (host)
+		printf("Listening to interface with ip=%s\n", host);
+	else if (listen_addr.ss_family == AF_INET)
+		printf("Listening to all IPv4 interfaces\n");
+	else
+		printf("Listening to all interfaces\n");
+	return 0;
+}
+
+/*
+ * Listen on unix:<path>, unixpacket:<path> or vsock:<port> instead of TCP
+ */
+static void listen_local(char *spec)
+{
+	struct sockaddr_storage addr;
+	struct sockaddr_un *sun = (struct sockaddr_un *)&addr;
+	struct sockaddr_vm *svm = (struct sockaddr_vm *)&addr;
+	socklen_t addr_len;
+	int type = SOCK_STREAM;
+
+	memset(&addr, 0, sizeof(addr));
+	if (!strncmp(spec, "vsock:", 6)) {
+		svm->svm_family = AF_VSOCK;
+		svm->svm_cid = VMADDR_CID_ANY;
+		svm->svm_port = atoi(spec + 6);
+		addr_len = sizeof(struct sockaddr_vm);
+		printf("Listening to vsock port %u\n", svm->svm_port);
+	} else {
+		if (!strncmp(spec, "unixpacket:", 11))
+			type = SOCK_SEQPACKET;
+		spec = strchr(spec, ':') + 1;
+		if (strlen(spec) >= sizeof(sun->sun_path)) {
+			fprintf(stderr, "unix socket path too long\n");
+			exit(1);
+		}
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, spec);
+		addr_len = sizeof(struct sockaddr_un);
+		unlink(spec);
+		printf("Listening to unix socket %s\n", spec);
+	}
+
+	shared_sock = socket(addr.ss_family, type, 0);
+	if (shared_sock < 0) {
+		perror("socket");
+		exit(1);
+	}
+	setnonblocking(shared_sock);
+	if (bind(shared_sock, (struct sockaddr *)&addr, addr_len)) {
+		perror("bind");
+		exit(1);
+	}
+	if (listen(shared_sock, BACKLOG)) {
+		perror("listen");
+		exit(1);
+	}
+	is_tcp = 0;
+}
+
 int main(int argc, char *argv[])
 {
-	int i, thread_no;
+	int i, j, c;
 	pthread_t tid;
+	char *prog = argv[0];
+
+	while ((c = getopt(argc, argv, "P:")) != -1) {
+		switch (c) {
+		case 'P':
+			// Seconds between the per-request cost reports
+			perf_interval = atoi(optarg);
+			break;
+		default:
+			return -1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
 
 	if (argc < 3) {
-		printf("Usage: %s <thread_count> port [ip_to_listen_on]\n", argv[0]);
+		printf("Usage: %s [-P interval] <thread_count> port|unix:path|unixpacket:path|vsock:port [address_to_listen_on]\n", prog);
 		return -1;
 	}
-	thread_no = atoi(argv[1]);
-	port = atoi(argv[2]);
-        if (argc == 4) {
-            printf("Listening to interface with ip=%s\n", argv[3]);
-            s_ip = inet_addr(argv[3]);
-        }
-        else {
-            printf("Listening to all interfaces\n");
-            s_ip = htons(0); // all addresses
-        }
-
-	for (i = 1; i < thread_no; i++) {
+	thread_count = atoi(argv[1]);
+	if (thread_count < 1 || thread_count > MAX_THREADS) {
+		fprintf(stderr, "thread_count must be between 1 and %d\n", MAX_THREADS);
+		return -1;
+	}
+	if (strchr(argv[2], ':'))
+		listen_local(argv[2]);
+	else if (listen_inet(argc == 4 ? argv[3] : NULL, argv[2]))
+		return -1;
+
+	/* The threads open their counters once they run */
+	for (i = 0; i < thread_count; i++)
+		for (j = 0; j < PERF_COUNTER_NR; j++)
+			counters[i].pc.fd[j] = -1;
+	if (perf_interval && pthread_create(&tid, NULL, perf_thread_main, NULL)) {
+		fprintf(stderr, "failed to spawn the counters thread\n");
+		exit(-1);
+	}
+
+	for (i = 1; i < thread_count; i++) {
 		if (pthread_create(&tid, NULL, tcp_thread_main, (void *) (long) i)) {
 			fprintf(stderr, "failed to spawn thread %d\n", i);
 			exit(-1);
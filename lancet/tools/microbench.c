@@ -0,0 +1,778 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+/*
+ * Microbenchmarks of the per-request building blocks of the agent, with
+ * checks that the distributions and the statistics are still right. The
+ * agent objects are linked in, the few agent and manager getters they
+ * use are answered here for a single measuring thread.
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lancet/agent.h>
+#include <lancet/app_proto.h>
+#include <lancet/manager.h>
+#include <lancet/misc.h>
+#include <lancet/rand_gen.h>
+#include <lancet/req_kernel.h>
+#include <lancet/stats.h>
+#include <lancet/tenant.h>
+#include <lancet/topology.h>
+
+#define MIN_BENCH_NS 200000000L
+#define MEAN_SAMPLES 2000000
+#define ASCII_MEM_RESPONSE 40
+
+int get_agent_tid(void)
+{
+	return 0;
+}
+
+enum agent_type get_agent_type(void)
+{
+	return SYMMETRIC_AGENT;
+}
+
+int get_thread_count(void)
+{
+	return 1;
+}
+
+int get_thread_conn_count(__attribute__((unused)) int thread)
+{
+	return 1;
+}
+
+int get_conn_count(void)
+{
+	return 1;
+}
+
+int get_target_count(void)
+{
+	return 1;
+}
+
+int get_perf_counters(void)
+{
+	return 0;
+}
+
+int placement_node(__attribute__((unused)) int thread)
+{
+	return 0;
+}
+
+int placement_node_count(void)
+{
+	return 1;
+}
+
+int should_measure(void)
+{
+	return 1;
+}
+
+typedef void (*bench_fn)(void *arg, long iters);
+
+static char *filter;
+static long min_ns = MIN_BENCH_NS;
+static int failures;
+static volatile double sink;
+
+/*
+ * Double the iterations until the run is long enough. size is the input
+ * size and items the number of items an operation works on.
+ */
+static void bench(const char *name, long size, long items, bench_fn fn,
+		void *arg)
+{
+	long iters, start, elapsed;
+
+	if (filter && !strstr(name, filter))
+		return;
+	for (iters = 1;; iters *= 2) {
+		start = time_ns();
+		fn(arg, iters);
+		elapsed = time_ns() - start;
+		if (elapsed >= min_ns || iters >= (1L << 40))
+			break;
+	}
+	printf("%-28s %8ld %12.1f %14.0f %10.2f\n", name, size,
+			(double)elapsed / iters, 1e9 * iters / elapsed,
+			(double)elapsed / iters / items);
+}
+
+static void check(const char *name, int ok, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (filter && !strstr(name, filter))
+		return;
+	printf("check %-22s %s (", name, ok ? "ok" : "FAILED");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf(")\n");
+	failures += !ok;
+}
+
+/*
+ * The agent prints its test statistics on stderr, silence them in the
+ * timed loops
+ */
+static int quiet(void)
+{
+	int saved, null;
+
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	null = open("/dev/null", O_WRONLY);
+	dup2(null, STDERR_FILENO);
+	close(null);
+	return saved;
+}
+
+static void loud(int saved)
+{
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+}
+
+/*
+ * Distributions
+ */
+struct dist {
+	const char *name;
+	char spec[64];
+	double avg; // set with set_avg, 0 if the distribution can't
+	double mean; // expected mean without set_avg
+};
+
+static void bench_generate(void *arg, long iters)
+{
+	struct rand_gen *gen = arg;
+	double sum = 0;
+	long i;
+
+	for (i = 0; i < iters; i++)
+		sum += generate(gen);
+	sink = sum;
+}
+
+static void bench_generate_exp(void *arg, long iters)
+{
+	struct rand_gen *gen = arg;
+	double sum = 0;
+	long i;
+
+	for (i = 0; i < iters; i++)
+		sum += generate_kind(gen, RAND_EXP);
+	sink = sum;
+}
+
+static double sample_mean(struct rand_gen *gen)
+{
+	double sum = 0;
+	long i;
+
+	for (i = 0; i < MEAN_SAMPLES; i++)
+		sum += generate(gen);
+	return sum / MEAN_SAMPLES;
+}
+
+static void run_distributions(void)
+{
+	/* GEV mean: loc + scale * (gamma(1 - shape) - 1) / shape */
+	struct dist dists[] = {
+		{"fixed", "fixed:5", 7, 0},
+		{"exp", "exp", 10, 0},
+		{"pareto", "pareto:0:1:0.15", 10, 0},
+		{"fb_ia", "fb_ia", 20, 0},
+		{"fb_val", "fb_val", 0, 15.0 + 214.476 / (1 - 0.348238)},
+		{"fb_key", "fb_key", 0,
+			30.7984 + 8.20449 * (tgamma(1 - 0.078688) - 1) / 0.078688},
+		{"bimodal", "bimodal:1:100:0.9", 0, 0.9 * 1 + 0.1 * 100},
+		{"lognorm", "lognorm:1:0.5", 0, exp(1 + 0.5 * 0.5 / 2)},
+	};
+	struct rand_gen *gen;
+	char name[64];
+	double mean, expected;
+	unsigned i;
+
+	for (i = 0; i < sizeof(dists) / sizeof(dists[0]); i++) {
+		gen = init_rand(dists[i].spec);
+		assert(gen);
+		if (dists[i].avg)
+			set_avg(gen, dists[i].avg);
+		expected = dists[i].avg ? dists[i].avg : dists[i].mean;
+		snprintf(name, sizeof(name), "generate/%s", dists[i].name);
+		bench(name, 1, 1, bench_generate, gen);
+		if (gen->kind == RAND_EXP) {
+			snprintf(name, sizeof(name), "generate_kind/%s",
+					dists[i].name);
+			bench(name, 1, 1, bench_generate_exp, gen);
+		}
+		mean = sample_mean(gen);
+		snprintf(name, sizeof(name), "mean/%s", dists[i].name);
+		/* The heavy tails converge slower */
+		check(name, fabs(mean - expected) < 0.03 * expected,
+				"%.4f expected %.4f", mean, expected);
+	}
+}
+
+/*
+ * Latency samples and percentiles
+ */
+struct samples_arg {
+	struct latency_stats lt_s;
+	long size;
+	struct timespec *tx;
+};
+
+static void fill_exp_samples(struct latency_stats *lt_s, long size,
+		double avg_ns)
+{
+	long i;
+
+	for (i = 0; i < size; i++) {
+		lt_s->samples.lat[i] = lround(-log(drand48()) * avg_ns);
+		lt_s->samples.tx[i] = i;
+	}
+	lt_s->size = size;
+	lt_s->count = size;
+}
+
+static void bench_add_latency(void *arg, long iters)
+{
+	struct samples_arg *a = arg;
+	long i;
+
+	for (i = 0; i < iters; i++)
+		add_latency_sample(1000 + (i & 1023), &a->tx[i & 1023], 0, 0);
+}
+
+static void bench_percentiles(void *arg, long iters)
+{
+	struct samples_arg *a = arg;
+	long i;
+
+	for (i = 0; i < iters; i++)
+		compute_latency_percentiles_ci(&a->lt_s);
+}
+
+static void bench_iid(void *arg, long iters)
+{
+	struct samples_arg *a = arg;
+	double sum = 0;
+	long i;
+	int saved;
+
+	saved = quiet();
+	for (i = 0; i < iters; i++)
+		sum += check_iid(&a->lt_s);
+	loud(saved);
+	sink = sum;
+}
+
+static void run_latency(void)
+{
+	long sizes[] = {1024, 65536, MAX_PER_THREAD_SAMPLES, AGG_SAMPLE_SIZE};
+	struct samples_arg a;
+	struct latency_stats *lt_s = &a.lt_s;
+	double avg = 10000, corr;
+	long i;
+	int saved;
+	unsigned s;
+
+	a.tx = malloc(1024 * sizeof(struct timespec));
+	assert(a.tx);
+	for (i = 0; i < 1024; i++)
+		time_ns_to_ts(&a.tx[i]);
+	for (s = 0; s < 3; s++) {
+		set_per_thread_samples(sizes[s], 100);
+		bench("add_latency_sample", sizes[s], 1, bench_add_latency, &a);
+	}
+
+	memset(lt_s, 0, sizeof(*lt_s));
+	if (alloc_lat_samples(&lt_s->samples, AGG_SAMPLE_SIZE))
+		exit(1);
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		fill_exp_samples(lt_s, sizes[s], avg);
+		bench("compute_percentiles_ci", sizes[s], sizes[s],
+				bench_percentiles, &a);
+		bench("check_iid", sizes[s], sizes[s], bench_iid, &a);
+	}
+
+	/* Exponential percentiles: -ln(1 - p) * avg */
+	fill_exp_samples(lt_s, AGG_SAMPLE_SIZE, avg);
+	compute_latency_percentiles_ci(lt_s);
+	check("percentiles/avg", fabs(lt_s->avg_lat - avg) < 0.01 * avg,
+			"%lu expected %.0f", lt_s->avg_lat, avg);
+	check("percentiles/p50", fabs(lt_s->p50 - log(2) * avg) <
+			0.01 * log(2) * avg, "%lu expected %.0f", lt_s->p50,
+			log(2) * avg);
+	check("percentiles/p99", fabs(lt_s->p99 - log(100) * avg) <
+			0.02 * log(100) * avg, "%lu expected %.0f", lt_s->p99,
+			log(100) * avg);
+	check("percentiles/ci", lt_s->p50_i <= lt_s->p50 &&
+			lt_s->p50 <= lt_s->p50_k && lt_s->p99_i <= lt_s->p99 &&
+			lt_s->p99 <= lt_s->p99_k, "p99 %lu-%lu-%lu", lt_s->p99_i,
+			lt_s->p99, lt_s->p99_k);
+
+	saved = quiet();
+	corr = check_iid(lt_s);
+	loud(saved);
+	check("iid/independent", fabs(corr) < 0.01, "correlation %.4f", corr);
+	/* A slow drift makes consecutive samples correlated */
+	for (i = 0; i < AGG_SAMPLE_SIZE; i++)
+		lt_s->samples.lat[i] = 1000 + (i / 4096) * 100 + (i & 7);
+	saved = quiet();
+	corr = check_iid(lt_s);
+	loud(saved);
+	check("iid/correlated", corr > 0.5, "correlation %.4f", corr);
+}
+
+/*
+ * Kolmogorov-Smirnov test of the inter-arrivals
+ */
+static void add_tx_samples(struct rand_gen *gen, long count)
+{
+	struct timespec ts = {1, 0};
+	long i, ns;
+
+	use_stats_buffer(0);
+	for (i = 0; i < count; i++) {
+		ns = ts.tv_nsec + lround(generate(gen) * 1000);
+		ts.tv_sec += ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		add_tx_timestamp(&ts);
+	}
+}
+
+static void bench_ks(void *arg, long iters)
+{
+	long i;
+	int saved, pass = 0;
+
+	saved = quiet();
+	for (i = 0; i < iters; i++)
+		pass += check_ia();
+	loud(saved);
+	sink = pass;
+}
+
+static void run_ks(void)
+{
+	long sizes[] = {256, MAX_PER_THREAD_TX_SAMPLES};
+	char exp_spec[] = "exp", ref_spec[] = "exp", fixed_spec[] = "fixed";
+	struct rand_gen *gen, *ref, *fixed;
+	int saved, pass;
+	unsigned s;
+
+	gen = init_rand(exp_spec);
+	ref = init_rand(ref_spec);
+	fixed = init_rand(fixed_spec);
+	assert(gen && ref && fixed);
+	set_avg(gen, 10);
+	set_avg(ref, 10);
+	set_avg(fixed, 10);
+	init_reference_ia_dist(ref);
+	collect_reference_ia(ref);
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		add_tx_samples(gen, sizes[s]);
+		bench("check_ia", sizes[s], sizes[s], bench_ks, NULL);
+	}
+
+	add_tx_samples(gen, MAX_PER_THREAD_TX_SAMPLES);
+	saved = quiet();
+	pass = check_ia();
+	loud(saved);
+	check("ks/same", pass, "exp against exp");
+	add_tx_samples(fixed, MAX_PER_THREAD_TX_SAMPLES);
+	saved = quiet();
+	pass = check_ia();
+	loud(saved);
+	check("ks/different", !pass, "fixed against exp");
+}
+
+/*
+ * ASCII memcached requests and responses
+ */
+struct ascii_arg {
+	struct application_protocol *proto;
+	struct iovec response;
+};
+
+static void bench_ascii_request(void *arg, long iters)
+{
+	struct ascii_arg *a = arg;
+	struct request req;
+	long i, bytes = 0;
+
+	for (i = 0; i < iters; i++) {
+		create_request(a->proto, &req);
+		bytes += req.iovs[0].iov_len;
+	}
+	sink = bytes;
+}
+
+static void bench_ascii_response(void *arg, long iters)
+{
+	struct ascii_arg *a = arg;
+	struct byte_req_pair res;
+	long i, reqs = 0;
+
+	for (i = 0; i < iters; i++) {
+		res = consume_response(a->proto, &a->response);
+		reqs += res.reqs;
+	}
+	sink = reqs;
+}
+
+static void run_ascii_mem(void)
+{
+	long counts[] = {1, 16, 256};
+	char spec[] = "ascii-mem";
+	struct ascii_arg a;
+	struct byte_req_pair res;
+	struct request req;
+	char *buf;
+	unsigned s;
+
+	a.proto = init_app_proto(spec);
+	assert(a.proto);
+	bench("ascii_mem_create_request", 1, 1, bench_ascii_request, &a);
+	create_request(a.proto, &req);
+	check("ascii_mem/request", req.iov_cnt == 1 &&
+			!strncmp(req.iovs[0].iov_base, "get ", 4) &&
+			!strncmp((char *)req.iovs[0].iov_base +
+				req.iovs[0].iov_len - 2, "\r\n", 2),
+			"%d bytes", (int)req.iovs[0].iov_len);
+
+	buf = malloc(256 * ASCII_MEM_RESPONSE);
+	assert(buf);
+	memset(buf, 'x', 256 * ASCII_MEM_RESPONSE);
+	a.response.iov_base = buf;
+	for (s = 0; s < sizeof(counts) / sizeof(counts[0]); s++) {
+		a.response.iov_len = counts[s] * ASCII_MEM_RESPONSE;
+		bench("ascii_mem_consume_response", counts[s], counts[s],
+				bench_ascii_response, &a);
+		res = consume_response(a.proto, &a.response);
+		check("ascii_mem/response", res.reqs == (uint64_t)counts[s] &&
+				res.bytes == a.response.iov_len,
+				"%lu of %ld responses", res.reqs, counts[s]);
+	}
+	/* A partial response waits for the rest */
+	a.response.iov_len = ASCII_MEM_RESPONSE + ASCII_MEM_RESPONSE / 2;
+	res = consume_response(a.proto, &a.response);
+	check("ascii_mem/partial", res.reqs == 1 &&
+			res.bytes == ASCII_MEM_RESPONSE, "%lu bytes", res.bytes);
+	free(buf);
+}
+
+/*
+ * Request kernels against the function pointers prepare_request() and
+ * get_next_tx() go through
+ */
+struct kernel_arg {
+	struct req_kernel k;
+	enum app_proto_type type;
+};
+
+static void bench_create_request(void *arg, long iters)
+{
+	struct kernel_arg *a = arg;
+	long i, bytes = 0;
+
+	for (i = 0; i < iters; i++) {
+		create_request(a->k.proto, &a->k.req);
+		bytes += a->k.req.iovs[0].iov_len;
+	}
+	sink = bytes;
+}
+
+static void bench_kernel_request(void *arg, long iters)
+{
+	struct kernel_arg *a = arg;
+	struct request *req;
+	long i, bytes = 0;
+
+	if (a->type == PROTO_SYNTHETIC)
+		for (i = 0; i < iters; i++) {
+			req = kernel_request(&a->k, PROTO_SYNTHETIC);
+			bytes += req->iovs[0].iov_len;
+		}
+	else
+		for (i = 0; i < iters; i++) {
+			req = kernel_request(&a->k, PROTO_ECHO);
+			bytes += req->iovs[0].iov_len;
+		}
+	sink = bytes;
+}
+
+static void bench_next_tx(void *arg, long iters)
+{
+	struct kernel_arg *a = arg;
+	long i, next_tx = 0;
+
+	for (i = 0; i < iters; i++)
+		next_tx += lround(generate(a->k.idist) * 1000);
+	sink = next_tx;
+}
+
+static void bench_kernel_next_tx(void *arg, long iters)
+{
+	struct kernel_arg *a = arg;
+	long i, next_tx = 0;
+
+	for (i = 0; i < iters; i++)
+		next_tx = kernel_next_tx(&a->k, next_tx, RAND_EXP);
+	sink = next_tx;
+}
+
+static void run_kernels(void)
+{
+	char *specs[] = {"echo:64", "synthetic:exp:10"};
+	char *names[] = {"echo", "synthetic"};
+	struct kernel_arg a;
+	struct request *req;
+	char spec[32], name[64];
+	unsigned i;
+	int len;
+
+	for (i = 0; i < sizeof(specs) / sizeof(specs[0]); i++) {
+		memset(&a, 0, sizeof(a));
+		snprintf(spec, sizeof(spec), "%s", specs[i]);
+		a.k.proto = init_app_proto(spec);
+		assert(a.k.proto);
+		a.type = a.k.proto->type;
+		snprintf(name, sizeof(name), "create_request/%s", names[i]);
+		bench(name, 1, 1, bench_create_request, &a);
+		snprintf(name, sizeof(name), "kernel_request/%s", names[i]);
+		bench(name, 1, 1, bench_kernel_request, &a);
+		create_request(a.k.proto, &a.k.req);
+		len = a.k.req.iovs[0].iov_len;
+		req = kernel_request(&a.k, a.type);
+		snprintf(name, sizeof(name), "kernel/%s", names[i]);
+		check(name, req->iov_cnt == 1 && (int)req->iovs[0].iov_len == len,
+				"%d bytes expected %d", (int)req->iovs[0].iov_len, len);
+	}
+
+	snprintf(spec, sizeof(spec), "exp");
+	a.k.idist = init_rand(spec);
+	assert(a.k.idist);
+	set_avg(a.k.idist, 10);
+	bench("next_tx/exp", 1, 1, bench_next_tx, &a);
+	bench("kernel_next_tx/exp", 1, 1, bench_kernel_next_tx, &a);
+}
+
+/*
+ * Tenants: the -T parser, the rate split and the schedule cursors
+ */
+#define SCHED_STEPS 1000
+
+static void run_tenant_parser(void)
+{
+	char good[] = "0-3/9/synthetic:fixed:20/fixed:5/onoff:2:1:0:1";
+	char *bad[] = {"", "0", "0/0", "0/-1", "0/1/nosuch", "0/1/-/nosuch",
+		"0/1/-/-/nosuch:1"};
+	char spec[64];
+	struct tenant t;
+	unsigned i;
+	int ret, saved;
+
+	ret = parse_tenant(good, &t);
+	check("tenant/parse", !ret && t.first_target == 0 &&
+			t.last_target == 3 && t.rate == 9 && t.app_proto &&
+			t.idist && t.load_sched, "ret %d targets %d-%d rate %.1f",
+			ret, t.first_target, t.last_target, t.rate);
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		snprintf(spec, sizeof(spec), "%s", bad[i]);
+		saved = quiet();
+		ret = parse_tenant(spec, &t);
+		loud(saved);
+		check("tenant/parse_reject", ret, "\"%s\"", bad[i]);
+	}
+}
+
+static void run_tenant_cover(void)
+{
+	struct tenant ok[2] = {{.first_target = 0, .last_target = 1, .rate = 1},
+		{.first_target = 2, .last_target = 2, .rate = 1}};
+	struct tenant overlap[2] = {{.first_target = 0, .last_target = 1,
+		.rate = 1}, {.first_target = 1, .last_target = 2, .rate = 1}};
+	struct tenant gap[2] = {{.first_target = 0, .last_target = 0,
+		.rate = 1}, {.first_target = 2, .last_target = 2, .rate = 1}};
+	int ret, saved;
+
+	ret = init_tenants(ok, 2, 3, NULL, "exp", NULL);
+	check("tenant/cover", !ret && ok[0].idist && ok[1].idist &&
+			find_tenant(ok, 2, 1) == 0 && find_tenant(ok, 2, 2) == 1,
+			"ret %d", ret);
+	saved = quiet();
+	ret = init_tenants(overlap, 2, 3, NULL, "exp", NULL);
+	loud(saved);
+	check("tenant/cover_overlap", ret, "ret %d", ret);
+	saved = quiet();
+	ret = init_tenants(gap, 2, 3, NULL, "exp", NULL);
+	loud(saved);
+	check("tenant/cover_gap", ret, "ret %d", ret);
+}
+
+/*
+ * Two tenants at 9:1 over 2 threads, each thread runs 4500 and 500 rps
+ */
+static void run_tenant_split(void)
+{
+	struct tenant t[2] = {{.first_target = 0, .last_target = 0, .rate = 9},
+		{.first_target = 1, .last_target = 1, .rate = 1}};
+	char step[] = "step:1:1,3:1";
+	double expected[2] = {1e6 / 4500, 1e6 / 500};
+	double mean, rate, want;
+	int i, ret;
+
+	ret = init_tenants(t, 2, 2, NULL, "exp", NULL);
+	assert(!ret);
+	tenants_set_load(t, 2, 10000, 2);
+	for (i = 0; i < 2; i++) {
+		mean = sample_mean(t[i].idist);
+		check(i ? "tenant/split_1" : "tenant/split_9",
+				fabs(mean - expected[i]) < 0.03 * expected[i],
+				"%.1f us expected %.1f", mean, expected[i]);
+	}
+
+	rate = tenants_offered_rate(t, 2, 10000, 0, 1000000000L);
+	check("tenant/offered", fabs(rate - 10000) < 1e-6, "%.1f expected %d",
+			rate, 10000);
+	/* The 1 tenant steps from 1x to 3x after a second */
+	t[1].load_sched = init_load_sched(step);
+	assert(t[1].load_sched);
+	tenants_set_load(t, 2, 10000, 2);
+	rate = tenants_offered_rate(t, 2, 10000, t[1].load_sched->start,
+			t[1].load_sched->start + 2000000000L);
+	want = 9000 + 1000 * (1 + 3) / 2.0;
+	check("tenant/offered_sched", fabs(rate - want) < 1e-6,
+			"%.1f expected %.1f", rate, want);
+}
+
+/* Offsets from the start of SCHED_STEPS arrivals 1ms of work apart */
+static void sched_offsets(struct load_sched *s, long *offsets, int i)
+{
+	long at = s->start + (i ? offsets[i - 1] : 0);
+
+	offsets[i] = load_sched_next(s, at, 1000000) - s->start;
+}
+
+/*
+ * Every schedule keeps its own cursor, interleaving two MMPP schedules
+ * replays the arrivals each one sends alone
+ */
+static void run_tenant_cursors(void)
+{
+	char spec_a[] = "mmpp:1:0.01,4:0.005";
+	char spec_b[] = "mmpp:0.5:0.002,2:0.02,0:0.001";
+	static long alone[2][SCHED_STEPS], mixed[2][SCHED_STEPS];
+	struct load_sched *s[2];
+	int i, j, diffs = 0;
+
+	s[0] = init_load_sched(spec_a);
+	s[1] = init_load_sched(spec_b);
+	assert(s[0] && s[1]);
+	for (j = 0; j < 2; j++) {
+		load_sched_start(s[j], 1000);
+		for (i = 0; i < SCHED_STEPS; i++)
+			sched_offsets(s[j], alone[j], i);
+	}
+	load_sched_start(s[0], 1000);
+	load_sched_start(s[1], 1000);
+	for (i = 0; i < SCHED_STEPS; i++)
+		for (j = 0; j < 2; j++)
+			sched_offsets(s[j], mixed[j], i);
+	for (j = 0; j < 2; j++)
+		for (i = 0; i < SCHED_STEPS; i++)
+			diffs += alone[j][i] != mixed[j][i];
+	check("tenant/cursors", !diffs, "%d of %d arrivals differ", diffs,
+			2 * SCHED_STEPS);
+}
+
+static void run_tenants(void)
+{
+	run_tenant_parser();
+	run_tenant_cover();
+	run_tenant_split();
+	run_tenant_cursors();
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "Usage: %s [-k kernel] [-q]\n"
+			"\t-k\tonly the benchmarks and checks matching kernel\n"
+			"\t-q\tshorter runs\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "k:q")) != -1) {
+		switch (c) {
+		case 'k':
+			filter = optarg;
+			break;
+		case 'q':
+			min_ns = MIN_BENCH_NS / 10;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	srand48(time(NULL));
+	if (init_stats_registry(1) || init_per_thread_stats())
+		return -1;
+
+	printf("%-28s %8s %12s %14s %10s\n", "#kernel", "size", "ns/op",
+			"ops/s", "ns/item");
+	run_distributions();
+	run_latency();
+	run_ks();
+	run_ascii_mem();
+	run_kernels();
+	run_tenants();
+
+	if (failures)
+		printf("%d checks FAILED\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,231 @@
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+
+/*
+ * Offline analysis of the sample dumps written by the agent with -o
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lancet/dump.h>
+#include <lancet/sort.h>
+
+enum group_by {
+	GROUP_ALL,
+	GROUP_TARGET,
+	GROUP_CONN,
+	GROUP_TIME,
+};
+
+static struct sample_record *records;
+static uint64_t record_count;
+static uint64_t *keys;
+static uint64_t *scratch;
+
+static int map_dump(char *path)
+{
+	int fd;
+	struct stat st;
+	void *addr;
+	struct dump_file_hdr *hdr;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		return -1;
+	}
+	if (st.st_size < (off_t)sizeof(struct dump_file_hdr)) {
+		fprintf(stderr, "%s: too short\n", path);
+		return -1;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	close(fd);
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+	hdr = (struct dump_file_hdr *)addr;
+	if (hdr->magic != DUMP_MAGIC || hdr->version != DUMP_VERSION ||
+			hdr->record_size != sizeof(struct sample_record)) {
+		fprintf(stderr, "%s: not a lancet sample dump\n", path);
+		return -1;
+	}
+	records = (struct sample_record *)(hdr + 1);
+	record_count = (st.st_size - sizeof(struct dump_file_hdr)) /
+		sizeof(struct sample_record);
+	fprintf(stderr, "%lu samples, %u threads, %u connections, %u targets\n",
+			record_count, hdr->thread_count, hdr->conn_count,
+			hdr->target_count);
+
+	return 0;
+}
+
+static inline uint64_t percentile(uint64_t *sorted, uint64_t n, int per_mille)
+{
+	return sorted[n * per_mille / 1000] & UINT32_MAX;
+}
+
+static void print_group(enum group_by by, uint64_t group, uint64_t *sorted,
+		uint64_t n, long interval)
+{
+	uint64_t i, sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += sorted[i] & UINT32_MAX;
+
+	if (by == GROUP_TIME)
+		printf("%lf\t%lu\t%lf\t", group * interval / 1e6, n,
+				n * 1e6 / interval);
+	else if (by != GROUP_ALL)
+		printf("%lu\t%lu\t", group, n);
+	else
+		printf("%lu\t", n);
+	printf("%lf\t%lf\t%lf\t%lf\t%lf\t%lf\t%lf\n", sum / (double)n / 1e3,
+			percentile(sorted, n, 500) / 1e3,
+			percentile(sorted, n, 900) / 1e3,
+			percentile(sorted, n, 950) / 1e3,
+			percentile(sorted, n, 990) / 1e3,
+			percentile(sorted, n, 999) / 1e3,
+			(sorted[n - 1] & UINT32_MAX) / 1e3);
+}
+
+/*
+ * The group goes to the upper half of the key and the latency to the
+ * lower one, so one sort orders both.
+ */
+static void analyze(enum group_by by, long interval)
+{
+	uint64_t i, start, group, min_tx = UINT64_MAX;
+
+	if (by == GROUP_TIME)
+		for (i = 0; i < record_count; i++)
+			if (records[i].tx && records[i].tx < min_tx)
+				min_tx = records[i].tx;
+
+	for (i = 0; i < record_count; i++) {
+		switch (by) {
+		case GROUP_TARGET:
+			group = records[i].target;
+			break;
+		case GROUP_CONN:
+			group = records[i].conn;
+			break;
+		case GROUP_TIME:
+			group = records[i].tx < min_tx ? 0 :
+				(records[i].tx - min_tx) / (interval * 1000);
+			break;
+		default:
+			group = 0;
+		}
+		assert(group <= UINT32_MAX);
+		keys[i] = (group << 32) | records[i].lat;
+	}
+	radix_sort(keys, scratch, record_count, idle_sort_workers(0));
+
+	if (by == GROUP_TIME)
+		printf("#Time(s)\tCount\tQPS\t");
+	else if (by == GROUP_TARGET)
+		printf("#Target\tCount\t");
+	else if (by == GROUP_CONN)
+		printf("#Conn\tCount\t");
+	else
+		printf("#Count\t");
+	printf("Avg Lat\t50th\t90th\t95th\t99th\t99.9th\tMax\n");
+
+	start = 0;
+	for (i = 1; i <= record_count; i++) {
+		if (i < record_count && (keys[i] >> 32) == (keys[start] >> 32))
+			continue;
+		print_group(by, keys[start] >> 32, &keys[start], i - start,
+				interval);
+		start = i;
+	}
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "Usage: %s [-t] [-c] [-i interval_us] <dump file>\n"
+			"\t-t\tper target breakdown\n"
+			"\t-c\tper connection breakdown\n"
+			"\t-i\ttime series with the given interval\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	enum group_by by = GROUP_ALL;
+	long interval = 0;
+
+	while ((c = getopt(argc, argv, "tci:")) != -1) {
+		switch (c) {
+		case 't':
+			by = GROUP_TARGET;
+			break;
+		case 'c':
+			by = GROUP_CONN;
+			break;
+		case 'i':
+			by = GROUP_TIME;
+			interval = atol(optarg);
+			if (interval <= 0) {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (map_dump(argv[optind]))
+		return -1;
+	if (!record_count)
+		return 0;
+	assert(record_count <= UINT32_MAX);
+
+	keys = malloc(record_count * sizeof(uint64_t));
+	scratch = malloc(record_count * sizeof(uint64_t));
+	if (!keys || !scratch) {
+		fprintf(stderr, "Failed to allocate sort buffers\n");
+		return -1;
+	}
+	analyze(by, interval);
+
+	return 0;
+}
@@ -0,0 +1,560 @@
+
+//Open Source License.
+//
+//Copyright 2019 Ecole Polytechnique Federale Lausanne (EPFL)
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+/*
+ * Loopback self-benchmark of the agent. Every configuration of the sweep
+ * runs against a zero-work echo sink in this process, or a server
+ * binary, and finds the highest load the agent sustains. The results go
+ * to a csv file to compare agent builds.
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lancet/agent.h>
+#include <lancet/coord_proto.h>
+#include <lancet/manager.h>
+#include <lancet/perf.h>
+
+#define MAX_LIST 16
+#define SINK_EVENTS 64
+#define SINK_BUF 65536
+#define MEASURE_SAMPLES 100000
+#define FLOOR_LOAD 1000
+#define FIRST_LOAD 10000
+#define MAX_LOAD 20000000
+
+struct int_list {
+	int count;
+	int v[MAX_LIST];
+};
+
+/*
+ * The result of a load step
+ */
+struct step {
+	uint64_t offered;
+	double rps;
+	double cpu_ns; // agent cpu time per request
+	double cycles; // per request, < 0 if not available
+	double instructions;
+	uint64_t p50; // ns, latency agents only
+	uint64_t p99;
+};
+
+static char *agent_path = "./agent";
+static char *server_path;
+static int port = 8100;
+static int sink_threads = 2;
+static int step_ms = 1000;
+static pid_t agent_pid;
+
+/*
+ * The sink echoes back whatever it reads, which answers both the echo
+ * and the synthetic protocols without doing any work. Its sockets are
+ * close-on-exec, an agent holding one would keep the epoll registration
+ * alive after the sink closed and reused the fd.
+ */
+static void *sink_main(void *arg)
+{
+	struct sockaddr_in addr;
+	struct epoll_event ev, events[SINK_EVENTS];
+	char buf[SINK_BUF];
+	int sock, epfd, fd, one = 1, i, n, ret, off, sent;
+
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	assert(sock >= 0);
+	setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) ||
+			listen(sock, 4096)) {
+		perror("sink");
+		exit(1);
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	assert(epfd >= 0);
+	ev.events = EPOLLIN;
+	ev.data.fd = sock;
+	ret = epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+	assert(!ret);
+	while (1) {
+		n = epoll_wait(epfd, events, SINK_EVENTS, -1);
+		for (i = 0; i < n; i++) {
+			fd = events[i].data.fd;
+			if (fd == sock) {
+				fd = accept4(sock, NULL, NULL,
+						SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (fd < 0)
+					continue;
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one,
+						sizeof(one));
+				ev.events = EPOLLIN;
+				ev.data.fd = fd;
+				ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+				assert(!ret);
+				continue;
+			}
+			ret = read(fd, buf, SINK_BUF);
+			if (ret <= 0) {
+				if (ret == 0 || errno != EAGAIN)
+					close(fd);
+				continue;
+			}
+			for (off = 0; off < ret;) {
+				sent = write(fd, buf + off, ret - off);
+				if (sent < 0 && errno != EAGAIN)
+					break;
+				if (sent > 0)
+					off += sent;
+			}
+		}
+	}
+	return NULL;
+}
+
+static pid_t spawn(char **argv)
+{
+	pid_t pid;
+	int fd;
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	}
+	if (pid == 0) {
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		execv(argv[0], argv);
+		perror("execv");
+		_exit(1);
+	}
+	return pid;
+}
+
+static void stop(pid_t pid)
+{
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+
+static void sleep_ms(long ms)
+{
+	struct timespec ts = {ms / 1000, (ms % 1000) * 1000000};
+
+	nanosleep(&ts, NULL);
+}
+
+static int connect_manager(void)
+{
+	struct sockaddr_in addr;
+	int fd, i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(MANAGER_PORT);
+	for (i = 0; i < 100; i++) {
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		assert(fd >= 0);
+		if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+			return fd;
+		close(fd);
+		sleep_ms(50);
+	}
+	fprintf(stderr, "The agent manager didn't come up\n");
+	return -1;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	while (off < len) {
+		n = read(fd, (char *)buf + off, len - off);
+		if (n <= 0)
+			return -1;
+		off += n;
+	}
+	return 0;
+}
+
+static int send_msg(int fd, uint32_t type, void *payload, uint32_t len)
+{
+	struct msg_hdr hdr = {type, len};
+	struct msg1 ack;
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+			write(fd, payload, len) != len)
+		return -1;
+	if (type == REPORT_REQ)
+		return 0;
+	if (read_full(fd, &ack, sizeof(ack)) || ack.Info != REPLY_ACK)
+		return -1;
+	return 0;
+}
+
+static int start_load(int fd, uint32_t load)
+{
+	return send_msg(fd, START_LOAD, &load, sizeof(load));
+}
+
+static int start_measure(int fd)
+{
+	struct __attribute__((__packed__)) {
+		uint32_t samples;
+		double sampling;
+	} m = {MEASURE_SAMPLES, 100.0};
+
+	return send_msg(fd, START_MEASURE, &m, sizeof(m));
+}
+
+/*
+ * The cpu time of all the agent threads, in ns
+ */
+static uint64_t agent_cpu_ns(void)
+{
+	char path[300];
+	struct dirent *d;
+	uint64_t total = 0, ns;
+	FILE *f;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", agent_pid);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+	while ((d = readdir(dir))) {
+		if (d->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%d/task/%s/schedstat",
+				agent_pid, d->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fscanf(f, "%lu", &ns) == 1)
+			total += ns;
+		fclose(f);
+	}
+	closedir(dir);
+	return total;
+}
+
+/*
+ * Cycles and instructions per request from the COUNTERS report
+ */
+static int read_counters(int fd, struct step *s, uint64_t requests)
+{
+	struct msg1 m;
+	struct counters_hdr hdr;
+	struct thread_counters_reply t;
+	uint32_t report = REPORT_COUNTERS;
+	uint64_t cycles = 0, instructions = 0;
+	uint32_t i;
+
+	if (send_msg(fd, REPORT_REQ, &report, sizeof(report)) ||
+			read_full(fd, &m, sizeof(m)) || m.Info != REPLY_COUNTERS ||
+			read_full(fd, &hdr, sizeof(hdr)))
+		return -1;
+	for (i = 0; i < hdr.Thread_count; i++) {
+		if (read_full(fd, &t, sizeof(t)))
+			return -1;
+		cycles += t.Cycles;
+		instructions += t.Instructions;
+	}
+	requests = requests ? requests : 1;
+	s->cycles = (hdr.Available & (1 << PERF_CYCLES)) ?
+		(double)cycles / requests : -1;
+	s->instructions = (hdr.Available & (1 << PERF_INSTRUCTIONS)) ?
+		(double)instructions / requests : -1;
+	return 0;
+}
+
+/*
+ * The timestamping agents follow the stats with the convergence, iid
+ * and inter-arrival checks
+ */
+static int skip_checks(int fd, int atype)
+{
+	struct __attribute__((__packed__)) {
+		struct msg1 conv;
+		uint32_t conv_val;
+		struct msg1 iid;
+		double iid_val;
+	} lat_checks;
+	struct msg2 ia;
+
+	if (atype != SYMMETRIC_NIC_TIMESTAMP_AGENT &&
+			atype != SYMMETRIC_SW_TIMESTAMP_AGENT)
+		return 0;
+	if (read_full(fd, &lat_checks, sizeof(lat_checks)))
+		return -1;
+	return read_full(fd, &ia, sizeof(ia));
+}
+
+/*
+ * Run one load step, the throughput agent replies with throughput stats
+ * and the others with latency stats
+ */
+static int run_step(int fd, int atype, uint32_t load, struct step *s)
+{
+	struct msg1 m;
+	struct latency_reply lat;
+	uint32_t report;
+	uint64_t cpu;
+
+	memset(s, 0, sizeof(*s));
+	s->offered = load;
+	if (start_load(fd, load))
+		return -1;
+	sleep_ms(step_ms / 2);
+	cpu = agent_cpu_ns();
+	if (start_measure(fd))
+		return -1;
+	sleep_ms(step_ms);
+	report = atype ? REPORT_LATENCY : REPORT_THROUGHPUT;
+	if (send_msg(fd, REPORT_REQ, &report, sizeof(report)) ||
+			read_full(fd, &m, sizeof(m)))
+		return -1;
+	cpu = agent_cpu_ns() - cpu;
+	if (atype) {
+		if (read_full(fd, &lat, sizeof(lat)))
+			return -1;
+		s->p50 = lat.P50;
+		s->p99 = lat.P99;
+	} else if (read_full(fd, &lat.Th_data, sizeof(lat.Th_data)))
+		return -1;
+	if (skip_checks(fd, atype))
+		return -1;
+	if (!lat.Th_data.Duration || !lat.Th_data.Req_count)
+		return 0;
+	s->rps = 1e6 * lat.Th_data.Req_count / lat.Th_data.Duration;
+	s->cpu_ns = (double)cpu / lat.Th_data.Req_count;
+	return read_counters(fd, s, lat.Th_data.Req_count);
+}
+
+/*
+ * The latency at a low load, then the load doubles until the agent
+ * falls 10% behind it
+ */
+static int bench(FILE *out, int atype, char *proto, int threads, int conns)
+{
+	char t[16], c[16], a[16], target[32];
+	char *argv[] = {agent_path, "-s", target, "-t", t, "-c", c, "-i",
+		"exp", "-p", "TCP", "-r", proto, "-a", a, "-P", NULL};
+	struct step floor, s, best;
+	uint32_t load;
+	int fd, ret = -1;
+
+	snprintf(t, sizeof(t), "%d", threads);
+	snprintf(c, sizeof(c), "%d", conns);
+	snprintf(a, sizeof(a), "%d", atype);
+	snprintf(target, sizeof(target), "127.0.0.1:%d", port);
+	agent_pid = spawn(argv);
+	fd = connect_manager();
+	if (fd < 0)
+		goto out;
+
+	memset(&floor, 0, sizeof(floor));
+	if (atype && run_step(fd, atype, FLOOR_LOAD, &floor))
+		goto out;
+	memset(&best, 0, sizeof(best));
+	best.cycles = best.instructions = -1;
+	for (load = FIRST_LOAD; load <= MAX_LOAD; load *= 2) {
+		if (run_step(fd, atype, load, &s))
+			goto out;
+		if (s.rps > best.rps)
+			best = s;
+		if (s.rps < 0.9 * load)
+			break;
+	}
+
+	fprintf(out, "%d,%s,%d,%d,%.0f,%.1f", atype, proto, threads, conns,
+			best.rps, best.cpu_ns);
+	if (best.cycles >= 0)
+		fprintf(out, ",%.1f", best.cycles);
+	else
+		fprintf(out, ",");
+	if (best.instructions >= 0)
+		fprintf(out, ",%.1f", best.instructions);
+	else
+		fprintf(out, ",");
+	if (atype)
+		fprintf(out, ",%.1f,%.1f\n", floor.p50 / 1e3, floor.p99 / 1e3);
+	else
+		fprintf(out, ",,\n");
+	fflush(out);
+	ret = 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	stop(agent_pid);
+	return ret;
+}
+
+static int parse_list(char *arg, struct int_list *l)
+{
+	char *token;
+
+	l->count = 0;
+	for (token = strtok(arg, ","); token; token = strtok(NULL, ",")) {
+		if (l->count == MAX_LIST)
+			return -1;
+		l->v[l->count++] = atoi(token);
+	}
+	return l->count ? 0 : -1;
+}
+
+static void usage(char *name)
+{
+	fprintf(stderr, "Usage: %s [-A agent] [-S server] [-o csv] [-a types] "
+			"[-r proto]... [-t threads] [-c conns] [-w sink_threads] "
+			"[-d step_ms]\n"
+			"\t-A\tagent binary, ./agent by default\n"
+			"\t-S\tserver binary taking <threads> <port> <address>, "
+			"an echo sink in this process by default\n"
+			"\t-o\tcsv output, stdout by default\n"
+			"\t-a\tagent types, 0,3 by default\n"
+			"\t-r\tapplication protocol, repeat for more\n"
+			"\t-t\tthread counts, 1,2 by default\n"
+			"\t-c\tconnection counts, 2,8 by default\n"
+			"\t-w\tsink or server threads, 2 by default\n"
+			"\t-d\tmeasurement length of a load step\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	struct int_list types = {2, {0, 3}};
+	struct int_list threads = {2, {1, 2}};
+	struct int_list conns = {2, {2, 8}};
+	char *protos[MAX_LIST] = {"synthetic:fixed:0", "echo:64"};
+	int proto_count = 0, c, a, p, t, n, i;
+	char arg_threads[16], arg_port[16];
+	char *server_argv[] = {NULL, arg_threads, arg_port, "127.0.0.1", NULL};
+	pthread_t tid;
+	pid_t server = 0;
+	FILE *out = stdout;
+
+	while ((c = getopt(argc, argv, "A:S:o:a:r:t:c:w:d:")) != -1) {
+		switch (c) {
+		case 'A':
+			agent_path = optarg;
+			break;
+		case 'S':
+			server_path = optarg;
+			break;
+		case 'o':
+			out = fopen(optarg, "we");
+			if (!out) {
+				perror("fopen");
+				return -1;
+			}
+			break;
+		case 'a':
+			if (parse_list(optarg, &types))
+				goto err;
+			break;
+		case 'r':
+			if (proto_count == MAX_LIST)
+				goto err;
+			protos[proto_count++] = optarg;
+			break;
+		case 't':
+			if (parse_list(optarg, &threads))
+				goto err;
+			break;
+		case 'c':
+			if (parse_list(optarg, &conns))
+				goto err;
+			break;
+		case 'w':
+			sink_threads = atoi(optarg);
+			break;
+		case 'd':
+			step_ms = atoi(optarg);
+			break;
+		default:
+			goto err;
+		}
+	}
+	/* A server binary only speaks the synthetic protocol */
+	if (!proto_count)
+		proto_count = server_path ? 1 : 2;
+
+	if (server_path) {
+		snprintf(arg_threads, sizeof(arg_threads), "%d", sink_threads);
+		snprintf(arg_port, sizeof(arg_port), "%d", port);
+		server_argv[0] = server_path;
+		server = spawn(server_argv);
+	} else {
+		for (i = 0; i < sink_threads; i++)
+			if (pthread_create(&tid, NULL, sink_main, NULL)) {
+				fprintf(stderr, "failed to spawn the sink\n");
+				return -1;
+			}
+	}
+	sleep_ms(200);
+
+	fprintf(out, "agent_type,protocol,threads,conns,max_rps,cpu_ns_per_req,"
+			"cycles_per_req,instructions_per_req,floor_p50_us,floor_p99_us\n");
+	for (a = 0; a < types.count; a++)
+		for (p = 0; p < proto_count; p++)
+			for (t = 0; t < threads.count; t++)
+				for (n = 0; n < conns.count; n++) {
+					if (conns.v[n] < threads.v[t])
+						continue;
+					if (bench(out, types.v[a], protos[p],
+								threads.v[t], conns.v[n]))
+						fprintf(stderr, "%d %s %d %d failed\n",
+								types.v[a], protos[p],
+								threads.v[t], conns.v[n]);
+				}
+
+	if (server)
+		stop(server);
+	fclose(out);
+	return 0;
+err:
+	usage(argv[0]);
+	return -1;
+}